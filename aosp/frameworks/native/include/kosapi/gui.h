@@ -43,6 +43,21 @@ void kosStopRecordScreen();
 void kosPauseRecordScreen(bool pause);
 bool kosRecordScreenPaused();
 
+// Timestamps of one frame passed to fdid_gui2_screen_captured, all in CLOCK_MONOTONIC microseconds.
+typedef struct {
+    uint32_t seq;           // increase by 1 every frame, start from 1
+    uint32_t size;          // length passed to fdid_gui2_screen_captured
+    int64_t pts_usec;       // presentation time of virtual display, it is composed at this time.
+    int64_t output_usec;    // dequeueOutputBuffer returned
+    int64_t delivered_usec; // fdid_gui2_screen_captured returned, 0 if it hasn't returned yet.
+    uint32_t input_seq;     // kosSendInput batch that this is the first frame composed after, 0 if none.
+    int64_t input_usec;     // that batch was injected at.
+} KosFrameTrace;
+
+// Copy traces whose seq > after_seq, oldest first. Only the latest 64 frames are kept.
+// Return count of copied traces.
+int kosGetFrameTraces(uint32_t after_seq, KosFrameTrace* traces, int max);
+
 #ifdef __cplusplus
 }
 #endif
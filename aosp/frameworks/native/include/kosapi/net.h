@@ -11,13 +11,24 @@
 extern "C" {
 #endif
 
+// Callbacks of this file are called in netd listener's thread, which also reads responses of kosNetSendMsg.
+// So kosNetSendMsg called in a callback returns -1 at once, use kosNetSendMsgAsync there, or post
+// the work to another thread. A callback that blocks delays every response and broadcast after it.
+
 // fkosNetStateChanged will run speical thread.
 typedef void (*fkosNetReceiveBroadcast)(int argc, const char** argv, void* user);
 void kosNetSetReceiveBroadcast(fkosNetReceiveBroadcast did, void* user);
 
 // max_bytes require include terminate char: '\0'
+// Thread-safe, concurrent callers don't wait for each other's response. Return -1 if netd doesn't respond in 3 seconds.
 int kosNetSendMsg(const char* msg, char* result, int maxBytes);
 
+// Called with response of kosNetSendMsgAsync in listener's thread, code is -1 if netd doesn't respond
+// in 3 seconds, then it is called in a helper thread. result is valid only during callback.
+typedef void (*fkosNetSendMsgDid)(int code, const char* result, void* user);
+// Send msg and return without waiting. Return command number(> 0), or -1 if fails and did won't be called.
+int kosNetSendMsgAsync(const char* msg, fkosNetSendMsgDid did, void* user);
+
 #ifdef __cplusplus
 }
 #endif
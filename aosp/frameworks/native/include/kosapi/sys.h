@@ -27,11 +27,100 @@ typedef void (*fdid_sys2_hover_moved)(int state, int action, float x, float y);
 
 void kosSetSysDid(fdid_sys2_touched did_touched, fdid_sys2_hover_moved did_hover_moved);
 
-void kosPumpEvent();
+// All pointers of one motion event and its historical samples, as struct of arrays.
+// Value of pointer p in sample s is at [s * pointer_count + p]. Samples are oldest first, the last one is current.
+// x/y are normalized to [0, 1] of display in its current orientation. Arrays are valid only during callback.
+typedef struct {
+    int device_id;
+    int source;
+    int action;         // AMOTION_EVENT_ACTION_XXX, masked
+    int action_index;   // pointer index of ACTION_POINTER_DOWN/UP
+    int pointer_count;
+    int sample_count;
+    const int* pointer_ids;         // [pointer_count]
+    const int64_t* event_times_ns;  // [sample_count], CLOCK_MONOTONIC
+    const float* x;                 // [sample_count * pointer_count]
+    const float* y;
+    const float* pressure;
+} KosMotionBatch;
+typedef void (*fdid_sys2_motion_batch)(const KosMotionBatch* batch, void* user);
+
+// When it is set, motion events go to it instead of fdid_sys2_touched/fdid_sys2_hover_moved.
+// frame_batching: moves are held and merged until kosConsumeBatchedInput, so they are aligned to app's frames.
+// It requires kosPumpEvent or kosGetInputFd in app's thread, not kosStartInputThread, InputConsumer isn't thread-safe.
+void kosSetMotionBatchDid(fdid_sys2_motion_batch did, void* user, bool frame_batching);
+// Call it once per frame(vsync) before drawing, frame_time_ns is CLOCK_MONOTONIC of the frame, moves are
+// resampled to it. Return true if a batched move is delivered.
+bool kosConsumeBatchedInput(int64_t frame_time_ns);
 
+void kosPumpEvent();
+// Instead of calling kosPumpEvent repeatedly, either
+// 1) add kosGetInputFd() to caller's poll/epoll, and call kosPumpEvent when it is readable.
+//    return -1 if input channel isn't ready yet, call it again later.
+// 2) kosStartInputThread, callbacks of kosSetSysDid are called in a thread that blocks until input arrives.
+//    kosPumpEvent does nothing while it is running.
+int kosGetInputFd();
+bool kosStartInputThread();
+void kosStopInputThread();
+
+// Independent virtual input devices. Every kind is one uinput device, created on first acquire and kept
+// until process exits, so a reconnect needn't UI_DEV_CREATE again. Mouse and touch are sized to display,
+// they are recreated only when display size changes.
+// kosSendInput routes every input to device of its type, input whose device isn't acquired is dropped.
+#define KOS_INPUT_DEVICE_KEYBOARD   1   // KOS_INPUT_KEYBOARD
+#define KOS_INPUT_DEVICE_MOUSE      2   // KOS_INPUT_MOUSE
+#define KOS_INPUT_DEVICE_TOUCH      3   // KOS_INPUT_TOUCH
+#define KOS_INPUT_DEVICE_RELATIVE_MOUSE 4 // KOS_INPUT_MOUSE when KOS_MOUSE_MODE_RELATIVE
+
+// There is one device per kind in process, shared by all callers, and acquire isn't reference counted.
+// Handle is kind itself, so every acquire of one kind returns same handle. A release from any caller
+// lifts keys and pointers of that device and stops it taking inputs until it is acquired again.
+// Return handle of device, 0 if kernel fails to create it. If display size changed and new device
+// fails, the old one is gone and the kind is released.
+int kosAcquireInputDevice(int kind, int screen_width, int screen_height);
+// Lift all keys and pointers, device is kept for next acquire.
+void kosReleaseInputDevice(int handle);
+
+// How KOS_INPUT_MOUSE is injected until next call, kosDestroyInput restores absolute.
+// In relative mode, inputs go to relative mouse device(REL_X/REL_Y), pointer-lock applications get raw motion.
+// Move without MOUSEEVENTF_ABSOLUTE is delta of dx/dy. Input with MOUSEEVENTF_ABSOLUTE moves by delta from
+// previous absolute position, first one only sets it, so pointer stops when client's pointer is at its edge.
+// Deltas are scaled by scale_permille / 1000, fractional pixels are accumulated to next move.
+// Return false if kernel fails to create relative mouse device.
+#define KOS_MOUSE_MODE_ABSOLUTE     0
+#define KOS_MOUSE_MODE_RELATIVE     1
+bool kosSetMouseMode(int mode, int scale_permille);
+
+// Acquire mouse, and keyboard if keyboard is true. Return false if mouse fails.
+// Touch device is acquired when first KOS_INPUT_TOUCH is sent, a session without touch never creates it.
 bool kosCreateInput(bool keyboard, int screen_width, int screen_height);
+// Release all acquired devices.
 void kosDestroyInput();
 
+// Raw evdev events of all input devices, injected ones included. A libkosapi thread reads them, it starts with
+// first kosSubscribeRawEvents, and runs until process exits. Injecting input doesn't start it.
+// The latest 1024 events are buffered. Every subscriber has its own cursor and sees events after it subscribes.
+// A slow subscriber blocks nobody, it loses the events that are overwritten before it reads them.
+typedef struct {
+    uint64_t seq;           // increase by 1 every event of all devices, start from 1
+    uint32_t device_seq;    // increase by 1 every event of this device, start from 1
+    int32_t device_id;
+    int64_t when_ns;        // kernel timestamp, CLOCK_MONOTONIC
+    int64_t read_time_ns;   // libkosapi read it, CLOCK_MONOTONIC
+    int32_t type;           // EV_XXX
+    int32_t code;
+    int32_t value;
+} KosRawEvent;
+typedef struct KosRawEventSubscriber KosRawEventSubscriber;
+
+// Call kosUnsubscribeRawEvents when done.
+KosRawEventSubscriber* kosSubscribeRawEvents();
+// Copy at most max events, oldest first, without blocking. Return count.
+// lost, if not NULL, receives how many events this subscriber has lost in total.
+// One subscriber must not be read by two threads at the same time.
+int kosReadRawEvents(KosRawEventSubscriber* subscriber, KosRawEvent* events, int max, uint64_t* lost);
+void kosUnsubscribeRawEvents(KosRawEventSubscriber* subscriber);
+
 #ifndef _WIN32
 //
 // keyboard section
@@ -81,9 +170,27 @@ typedef struct {
     // ULONG_PTR dwExtraInfo;
 } KosKeybdInput;
 
+// one contact of a multi-touch frame. consecutive KOS_INPUT_TOUCH inputs in one kosSendInput
+// (or one kosBeginInputBatch/kosEndInputBatch) are one frame, they are injected with one SYN_REPORT.
+#define KOS_MAX_TOUCH_CONTACTS  10
+
+#define TOUCHEVENTF_DOWN    0x0001 /* contact touches */
+#define TOUCHEVENTF_UPDATE  0x0002 /* contact moves */
+#define TOUCHEVENTF_UP      0x0004 /* contact leaves */
+#define TOUCHEVENTF_CANCEL  0x0008 /* contact is canceled, same as up */
+
+typedef struct {
+    int    x;
+    int    y;
+    uint16_t   contact_id;  // [0, KOS_MAX_TOUCH_CONTACTS)
+    uint16_t   flags;
+    uint32_t   time;
+} KosTouchInput;
+
 #define KOS_INPUT_MOUSE     0
 #define KOS_INPUT_KEYBOARD  1
 #define KOS_INPUT_HARDWARE  2
+#define KOS_INPUT_TOUCH     3
 
 typedef struct {
     uint32_t   type;
@@ -91,12 +198,22 @@ typedef struct {
     {
         KosMouseInput      mi;
         KosKeybdInput      ki;
+        KosTouchInput      ti;
     } u;
 } KosInput;
 
 uint32_t kosSendInput(uint32_t input_count, // number of input in the array
     KosInput* inputs);  // array of inputs
 
+// Between them, kosSendInput only queues inputs. kosEndInputBatch injects all queued inputs
+// in as few frames(SYN_REPORT) as possible, so InputReader sees few atomic updates for one network packet.
+// A frame can't carry a code twice nor more than 16 distinct codes, or InputReader would see final
+// state only. So an event that repeats a code of current frame, e.g. BTN_TOUCH up after down, or a 17th
+// distinct code, ends current frame and starts next one. Keyboard, mouse and touch are separate frames.
+// Can be nested, the outermost kosEndInputBatch injects.
+void kosBeginInputBatch();
+void kosEndInputBatch();
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,13 +18,15 @@ LOCAL_CFLAGS += -DWEBRTC_POSIX
 #
 LOCAL_SRC_FILES:= \
     sendinput.cpp \
+    eventhub.cpp \
     NetdListener.cpp
 
 LOCAL_SRC_FILES += \
     screenrecord/screenrecord.cpp \
     screenrecord/EglWindow.cpp \
     screenrecord/FrameOutput.cpp \
-    screenrecord/Program.cpp
+    screenrecord/Program.cpp \
+    screenrecord/SyntheticSource.cpp
 
 LOCAL_SRC_FILES += \
     webrtc/rtc_base/event.cpp \
@@ -28,6 +28,7 @@
 #include <input/InputTransport.h>
 
 #include <ScopedLocalRef.h>
+#include <kosapi/gui.h>
 
 namespace android {
 
@@ -38,10 +39,17 @@ NativeInputEventReceiver::NativeInputEventReceiver(const sp<InputChannel>& input
         , mLooper(new Looper(false))
         , mBatchedInputEventPending(false)
         , mFdEvents(0)
-        , did_touched_(NULL) {
+        , did_touched_(NULL)
+        , did_hover_moved_(NULL)
+        , did_motion_batch_(NULL)
+        , motion_batch_user_(NULL)
+        , mFrameBatching(false)
+        , mDisplayWidth(1920)
+        , mDisplayHeight(1080) {
     if (kDebugDispatchCycle) {
         ALOGD("channel '%s' ~ Initializing input event receiver.", getInputChannelName());
     }
+    updateDisplaySize();
 }
 
 NativeInputEventReceiver::~NativeInputEventReceiver() {
@@ -58,6 +66,78 @@ void NativeInputEventReceiver::set_did(fdid_sys2_touched did_touched, fdid_sys2_
     did_hover_moved_ = did_hover_moved;
 }
 
+void NativeInputEventReceiver::set_motion_batch_did(fdid_sys2_motion_batch did, void* user, bool frameBatching)
+{
+    did_motion_batch_ = did;
+    motion_batch_user_ = user;
+    mFrameBatching = did != NULL && frameBatching;
+}
+
+bool NativeInputEventReceiver::consumeBatchedInput(nsecs_t frameTime)
+{
+    if (!mBatchedInputEventPending) {
+        return false;
+    }
+    bool consumedBatch = false;
+    consumeEvents(true, frameTime, &consumedBatch);
+    return consumedBatch;
+}
+
+void NativeInputEventReceiver::updateDisplaySize()
+{
+    KosDisplayInfo info;
+    kosGetDisplayInfo(&info);
+    if (info.w == 0 || info.h == 0) {
+        return;
+    }
+    // w/h of KosDisplayInfo are in KOS_DISPLAY_ORIENTATION_0.
+    const bool rotated = info.orientation == KOS_DISPLAY_ORIENTATION_90 || info.orientation == KOS_DISPLAY_ORIENTATION_270;
+    mDisplayWidth = rotated? info.h: info.w;
+    mDisplayHeight = rotated? info.w: info.h;
+}
+
+void NativeInputEventReceiver::deliverMotionBatch(const MotionEvent& event)
+{
+    const size_t pointerCount = event.getPointerCount();
+    const size_t historySize = event.getHistorySize();
+    const size_t sampleCount = historySize + 1;
+    mBatchPointerIds.resize(pointerCount);
+    mBatchTimes.resize(sampleCount);
+    mBatchX.resize(sampleCount * pointerCount);
+    mBatchY.resize(sampleCount * pointerCount);
+    mBatchPressure.resize(sampleCount * pointerCount);
+
+    for (size_t p = 0; p < pointerCount; p++) {
+        mBatchPointerIds[p] = event.getPointerId(p);
+    }
+    for (size_t s = 0; s < sampleCount; s++) {
+        const bool current = s == historySize;
+        mBatchTimes[s] = current? event.getEventTime(): event.getHistoricalEventTime(s);
+        float* x = &mBatchX[s * pointerCount];
+        float* y = &mBatchY[s * pointerCount];
+        float* pressure = &mBatchPressure[s * pointerCount];
+        for (size_t p = 0; p < pointerCount; p++) {
+            x[p] = (current? event.getX(p): event.getHistoricalX(p, s)) / mDisplayWidth;
+            y[p] = (current? event.getY(p): event.getHistoricalY(p, s)) / mDisplayHeight;
+            pressure[p] = current? event.getPressure(p): event.getHistoricalPressure(p, s);
+        }
+    }
+
+    KosMotionBatch batch;
+    batch.device_id = event.getDeviceId();
+    batch.source = event.getSource();
+    batch.action = event.getActionMasked();
+    batch.action_index = event.getActionIndex();
+    batch.pointer_count = pointerCount;
+    batch.sample_count = sampleCount;
+    batch.pointer_ids = mBatchPointerIds.data();
+    batch.event_times_ns = mBatchTimes.data();
+    batch.x = mBatchX.data();
+    batch.y = mBatchY.data();
+    batch.pressure = mBatchPressure.data();
+    did_motion_batch_(&batch, motion_batch_user_);
+}
+
 void NativeInputEventReceiver::dispose() {
     if (kDebugDispatchCycle) {
         ALOGD("channel '%s' ~ Disposing input event receiver.", getInputChannelName());
@@ -118,8 +198,8 @@ int NativeInputEventReceiver::handleEvent(int /*receiveFd*/, int events, void* /
     }
 
     if (events & ALOOPER_EVENT_INPUT) {
-        // set consumeBatches to true,  I hope not to use batch.
-        status_t status = consumeEvents(true, -1, NULL);
+        // without frame batching, consume batches at once, moves are delivered as they arrive.
+        status_t status = consumeEvents(!mFrameBatching, -1, NULL);
         return status == OK || status == NO_MEMORY ? 1 : 0;
     }
 
@@ -183,6 +263,10 @@ status_t NativeInputEventReceiver::consumeEvents(bool consumeBatches, nsecs_t fr
         if (status) {
             if (status == WOULD_BLOCK) {
                 // normal. have read all message.
+                if (!consumeBatches && mInputConsumer.hasPendingBatch()) {
+                    // kosConsumeBatchedInput will consume it at next frame.
+                    mBatchedInputEventPending = true;
+                }
                 return OK;
             }
             ALOGE("channel '%s' ~ Failed to consume input event.  status=%d",
@@ -216,6 +300,14 @@ status_t NativeInputEventReceiver::consumeEvents(bool consumeBatches, nsecs_t fr
 
                 int actionMasked = motionEvent->getActionMasked();
                 int actionIndex = motionEvent->getActionIndex();
+                if (actionMasked == AMOTION_EVENT_ACTION_DOWN) {
+                    // orientation may change between gestures.
+                    updateDisplaySize();
+                }
+                if (did_motion_batch_) {
+                    deliverMotionBatch(*motionEvent);
+                    break;
+                }
                 float x = motionEvent->getX(0);
                 float y = motionEvent->getY(0);
                 if (kDebugDispatchCycle) {
@@ -223,7 +315,7 @@ status_t NativeInputEventReceiver::consumeEvents(bool consumeBatches, nsecs_t fr
                 }
                 if (actionMasked == AMOTION_EVENT_ACTION_DOWN || actionMasked == AMOTION_EVENT_ACTION_UP || actionMasked == AMOTION_EVENT_ACTION_MOVE) {
                     if (did_touched_) {
-                        did_touched_(motionEvent->getDeviceId(), actionIndex, actionMasked, x / 1920, y / 1080, 0);
+                        did_touched_(motionEvent->getDeviceId(), actionIndex, actionMasked, x / mDisplayWidth, y / mDisplayHeight, 0);
                     }
                 }
                 if (actionMasked == AMOTION_EVENT_ACTION_HOVER_MOVE) {
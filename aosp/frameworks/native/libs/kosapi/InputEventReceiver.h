@@ -26,6 +26,7 @@
 
 #include <ScopedLocalRef.h>
 #include <kosapi/sys2.h>
+#include <vector>
 
 namespace android {
 
@@ -35,12 +36,23 @@ public:
 
     status_t initialize();
     void set_did(fdid_sys2_touched did_touched, fdid_sys2_hover_moved did_hover_moved);
+    void set_motion_batch_did(fdid_sys2_motion_batch did, void* user, bool frameBatching);
+    // consume moves held by InputConsumer, resample them to frameTime.
+    bool consumeBatchedInput(nsecs_t frameTime);
     void dispose();
     status_t finishInputEvent(uint32_t seq, bool handled);
     status_t consumeEvents(bool consumeBatches, nsecs_t frameTime,
             bool* outConsumedBatch);
-    void pollOnce() {
-        mLooper->pollOnce(0);
+    // timeoutMillis: 0 returns immediately, -1 blocks until an event arrives or wake is called.
+    void pollOnce(int timeoutMillis = 0) {
+        mLooper->pollOnce(timeoutMillis);
+    }
+    void wake() {
+        mLooper->wake();
+    }
+    // readable when input is pending.
+    int getFd() {
+        return mInputConsumer.getChannel()->getFd();
     }
 
 protected:
@@ -48,6 +60,9 @@ protected:
 
 private:
     void setFdEvents(int events);
+    // display size in current orientation, x/y of motion event are normalized by it.
+    void updateDisplaySize();
+    void deliverMotionBatch(const MotionEvent& event);
 
     const char* getInputChannelName() {
         return mInputConsumer.getChannel()->getName().string();
@@ -69,6 +84,18 @@ private:
     Vector<Finish> mFinishQueue;
     fdid_sys2_touched did_touched_;
     fdid_sys2_hover_moved did_hover_moved_;
+
+    fdid_sys2_motion_batch did_motion_batch_;
+    void* motion_batch_user_;
+    bool mFrameBatching;
+    float mDisplayWidth;
+    float mDisplayHeight;
+    // arrays of KosMotionBatch, reused by every event.
+    std::vector<int> mBatchPointerIds;
+    std::vector<int64_t> mBatchTimes;
+    std::vector<float> mBatchX;
+    std::vector<float> mBatchY;
+    std::vector<float> mBatchPressure;
 };
 
 } // namespace android
@@ -51,6 +51,42 @@
 
 static const int CMD_BUF_SIZE = 1024;
 
+static void initMonotonicCond(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static bool isExpired(const struct timespec& deadline, const struct timespec& now)
+{
+    return now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec);
+}
+
+NetdListener::tslot::tslot(char* _result, int _maxBytes, fkosNetSendMsgDid _did, void* _user)
+    : result(_result)
+    , maxBytes(_maxBytes)
+    , code(0)
+    , done(false)
+    , did(_did)
+    , user(_user)
+{
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += RESP_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (RESP_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec ++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    initMonotonicCond(&cond);
+}
+
+NetdListener::tslot::~tslot()
+{
+    pthread_cond_destroy(&cond);
+}
 
 NetdListener::NetdListener(int sock) :
                  SocketListener(sock, false)
@@ -59,15 +95,45 @@ NetdListener::NetdListener(int sock) :
                  , mWithSeq(false)
                  , mNetReceiveBroadcast(nullptr)
                  , mNetReceiveBroadcastUser(nullptr)
-                 , mRespEvent(true, false)
+                 , mListenerTid(0)
+                 , mExpireThreadRunning(false)
+                 , mStopping(false)
 {
     ALOGD("------NetdListener::NetdListener------, sock: %i, this: 0x%p", sock, this);
     pthread_mutex_init(&mSlotsLock, NULL);
+    initMonotonicCond(&mExpireCond);
 }
 
 NetdListener::~NetdListener()
 {
     ALOGD("------NetdListener::~NetdListener------ this: 0x%p", this);
+    pthread_mutex_lock(&mSlotsLock);
+    mStopping = true;
+    pthread_cond_signal(&mExpireCond);
+    pthread_mutex_unlock(&mSlotsLock);
+    if (mExpireThread.joinable()) {
+        mExpireThread.join();
+    }
+
+    // async slots that netd hasn't responded, did still gets its -1. sync slots are on their callers' stack.
+    std::vector<tslot*> pending;
+    pthread_mutex_lock(&mSlotsLock);
+    for (std::map<int, tslot*>::iterator it = mSlots.begin(); it != mSlots.end();) {
+        if (it->second->did != nullptr) {
+            pending.push_back(it->second);
+            mSlots.erase(it ++);
+        } else {
+            ++ it;
+        }
+    }
+    pthread_mutex_unlock(&mSlotsLock);
+    for (std::vector<tslot*>::const_iterator it = pending.begin(); it != pending.end(); ++ it) {
+        tslot* slot = *it;
+        slot->did(SendMsgFailCode, "", slot->user);
+        delete slot;
+    }
+    pthread_cond_destroy(&mExpireCond);
+    pthread_mutex_destroy(&mSlotsLock);
 }
 
 bool NetdListener::onDataAvailable(SocketClient *c)
@@ -75,6 +141,7 @@ bool NetdListener::onDataAvailable(SocketClient *c)
     char buffer[CMD_BUF_SIZE];
     int len;
 
+    mListenerTid = gettid();
     len = TEMP_FAILURE_RETRY(read(c->getSocket(), buffer, sizeof(buffer)));
     ALOGD("NetdListener::onDataAvailable, len: %i", len);
     if (len < 0) {
@@ -302,31 +369,74 @@ void NetdListener::runCommand(int argc, char ** argv)
         return;
     }
     pthread_mutex_lock(&mSlotsLock);
-    tslot* slotPtr = nullptr;
-    if (mSlots.count(cmdNum) != 0) {
-        slotPtr = &(mSlots.find(cmdNum)->second);
-    }
-    if (slotPtr != nullptr) {
-        slotPtr->code = code;
-        int residue = slotPtr->maxBytes;
-        char* ptr = slotPtr->result;
-        for (int n = 2; n < argc; n ++) {
-            int len = strlen(argv[n]);
-            if (residue <= len) {
-                break;
-            }
-            memcpy(ptr, argv[n], len);
-            ptr[len] = ' ';
-            ptr += len + 1;
-            residue -= len + 1;
-        }
-        if (ptr != slotPtr->result) {
-            ptr --;
-            *ptr = '\0';
+    std::map<int, tslot*>::iterator findIt = mSlots.find(cmdNum);
+    if (findIt == mSlots.end()) {
+        // caller has timed out.
+        pthread_mutex_unlock(&mSlotsLock);
+        ALOGD("runCommand, cmdNum: %i, no one waits for it", cmdNum);
+        return;
+    }
+    tslot* slotPtr = findIt->second;
+    slotPtr->code = code;
+    int residue = slotPtr->maxBytes;
+    char* ptr = slotPtr->result;
+    *ptr = '\0';
+    for (int n = 2; n < argc; n ++) {
+        int len = strlen(argv[n]);
+        if (residue <= len) {
+            break;
         }
-        mRespEvent.Set();
+        memcpy(ptr, argv[n], len);
+        ptr[len] = ' ';
+        ptr += len + 1;
+        residue -= len + 1;
+    }
+    if (ptr != slotPtr->result) {
+        ptr --;
+        *ptr = '\0';
+    }
+    slotPtr->done = true;
+
+    if (slotPtr->did == nullptr) {
+        // sendMsg removes it.
+        pthread_cond_signal(&slotPtr->cond);
+        pthread_mutex_unlock(&mSlotsLock);
+        return;
     }
+    mSlots.erase(findIt);
     pthread_mutex_unlock(&mSlotsLock);
+
+    slotPtr->did(slotPtr->code, slotPtr->result, slotPtr->user);
+    delete slotPtr;
+}
+
+int NetdListener::registerSlotLocked(tslot* slot)
+{
+    // after wraparound, skip cmdNum that is still in flight.
+    while (mSlots.count(mCmdNum) != 0) {
+        mCmdNum = mCmdNum != CMDNUM_MAX? mCmdNum + 1: CMDNUM_MIN;
+    }
+    const int cmdNum = mCmdNum;
+    mSlots.insert(std::make_pair(cmdNum, slot));
+    mCmdNum = mCmdNum != CMDNUM_MAX? mCmdNum + 1: CMDNUM_MIN;
+    return cmdNum;
+}
+
+bool NetdListener::sendCmd(int cmdNum, const char* msg)
+{
+    char* buf;
+    if (asprintf(&buf, "%d %s", cmdNum, msg) < 0) {
+        return false;
+    }
+    int ret = -1;
+    pthread_mutex_lock(&mClientsLock);
+    if (!mClients->empty()) {
+        SocketClient* c = *(mClients->begin());
+        ret = c->sendMsg(buf);
+    }
+    pthread_mutex_unlock(&mClientsLock);
+    free(buf);
+    return ret == 0;
 }
 
 int NetdListener::sendMsg(const char* msg, char* resp, int maxBytes)
@@ -343,38 +453,128 @@ int NetdListener::sendMsg(const char* msg, char* resp, int maxBytes)
         ALOGD("NetdListener::sendMsg, resp must be valid");
         return SendMsgFailCode;
     }
+    if (gettid() == mListenerTid) {
+        // response would be read by this thread after it gives up waiting.
+        ALOGE("NetdListener::sendMsg, msg: %s, called in listener's thread, use kosNetSendMsgAsync", msg);
+        return SendMsgFailCode;
+    }
 
 
+    tslot slot(resp, maxBytes, nullptr, nullptr);
     pthread_mutex_lock(&mSlotsLock);
     ALOGD("NetdListener::sendMsg, msg: %s, maxBytes: %i, mSlots: %i", msg, maxBytes, (int)mSlots.size());
+    const int cmdNum = registerSlotLocked(&slot);
+    pthread_mutex_unlock(&mSlotsLock);
 
-    mSlots.insert(std::make_pair(mCmdNum, tslot(resp, maxBytes)));
+    const bool sent = sendCmd(cmdNum, msg);
 
-    char* buf;
-    asprintf(&buf, "%d %s", mCmdNum, msg);
-    const int cmdNum = mCmdNum;
-    mCmdNum = mCmdNum != CMDNUM_MAX? mCmdNum + 1: CMDNUM_MIN;
+    // Every caller waits on its own slot, so responses can complete in any order.
+    pthread_mutex_lock(&mSlotsLock);
+    while (sent && !slot.done) {
+        if (pthread_cond_timedwait(&slot.cond, &mSlotsLock, &slot.deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    mSlots.erase(cmdNum);
     pthread_mutex_unlock(&mSlotsLock);
 
-    mRespEvent.Reset();
-    pthread_mutex_lock(&mClientsLock);
-    SocketClient* c = *(mClients->begin());
-    c->sendMsg(buf);
-    pthread_mutex_unlock(&mClientsLock);
-    free(buf);
+    if (!slot.done) {
+        ALOGD("NetdListener::sendMsg, msg: %s, %s", msg, sent? "post wait fail": "send fail");
+        return SendMsgFailCode;
+    }
+    return slot.code;
+}
 
-    const int overflowMs = 3000;
-    if (!mRespEvent.Wait(overflowMs)) {
-        ALOGD("NetdListener::sendMsg, msg: %s, post wait fail", msg);
-        mRespEvent.Reset();
+int NetdListener::sendMsgAsync(const char* msg, fkosNetSendMsgDid did, void* user)
+{
+    if (msg == nullptr || msg[0] == '\0') {
+        ALOGD("NetdListener::sendMsgAsync, msg must not empty");
+        return SendMsgFailCode;
+    }
+    if (did == nullptr) {
+        ALOGD("NetdListener::sendMsgAsync, did must be valid");
+        return SendMsgFailCode;
     }
 
+    tslot* slot = new tslot(nullptr, CMD_BUF_SIZE, did, user);
+    slot->asyncResult.resize(CMD_BUF_SIZE);
+    slot->result = slot->asyncResult.data();
+
     pthread_mutex_lock(&mSlotsLock);
-    std::map<int, tslot>::iterator findIt = mSlots.find(cmdNum);
-    const int code = findIt->second.code;
-    mSlots.erase(findIt);
+    const int cmdNum = registerSlotLocked(slot);
+    if (!mExpireThreadRunning) {
+        if (mExpireThread.joinable()) {
+            // it has exited or is exiting, it won't take mSlotsLock again.
+            mExpireThread.join();
+        }
+        mExpireThreadRunning = true;
+        mExpireThread = std::thread(&NetdListener::expireAsyncSlots, this);
+    }
+    pthread_mutex_unlock(&mSlotsLock);
+
+    if (!sendCmd(cmdNum, msg)) {
+        // Unless expire thread has taken it, did must not be called.
+        pthread_mutex_lock(&mSlotsLock);
+        std::map<int, tslot*>::iterator findIt = mSlots.find(cmdNum);
+        const bool removed = findIt != mSlots.end();
+        if (removed) {
+            mSlots.erase(findIt);
+        }
+        pthread_mutex_unlock(&mSlotsLock);
+        if (removed) {
+            delete slot;
+            ALOGD("NetdListener::sendMsgAsync, msg: %s, send fail", msg);
+            return SendMsgFailCode;
+        }
+    }
+    return cmdNum;
+}
+
+void NetdListener::expireAsyncSlots()
+{
+    std::vector<tslot*> expired;
+    pthread_mutex_lock(&mSlotsLock);
+    while (!mStopping) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        const struct timespec* earliest = nullptr;
+        for (std::map<int, tslot*>::iterator it = mSlots.begin(); it != mSlots.end();) {
+            tslot* slot = it->second;
+            if (slot->did == nullptr) {
+                ++ it;
+            } else if (isExpired(slot->deadline, now)) {
+                expired.push_back(slot);
+                mSlots.erase(it ++);
+            } else {
+                if (earliest == nullptr || isExpired(*earliest, slot->deadline)) {
+                    earliest = &slot->deadline;
+                }
+                ++ it;
+            }
+        }
+
+        if (!expired.empty()) {
+            pthread_mutex_unlock(&mSlotsLock);
+            for (std::vector<tslot*>::const_iterator it = expired.begin(); it != expired.end(); ++ it) {
+                tslot* slot = *it;
+                ALOGD("NetdListener::expireAsyncSlots, no response in %i ms", RESP_TIMEOUT_MS);
+                slot->did(SendMsgFailCode, "", slot->user);
+                delete slot;
+            }
+            expired.clear();
+            pthread_mutex_lock(&mSlotsLock);
+            continue;
+        }
+        if (earliest == nullptr) {
+            break;
+        }
+        // Later slots have later deadline, so no one needs to signal it except destructor.
+        // copy it, slot may be completed and deleted while waiting.
+        const struct timespec deadline = *earliest;
+        pthread_cond_timedwait(&mExpireCond, &mSlotsLock, &deadline);
+    }
+    mExpireThreadRunning = false;
     pthread_mutex_unlock(&mSlotsLock);
-    return code;
 }
 
 static NetdListener* netdl = nullptr;
@@ -412,3 +612,11 @@ NDK_EXPORT int kosNetSendMsg(const char* msg, char* result, int maxBytes)
     }
     return netdl->sendMsg(msg, result, maxBytes);
 }
+
+NDK_EXPORT int kosNetSendMsgAsync(const char* msg, fkosNetSendMsgDid did, void* user)
+{
+    if (makeSureNetdListener() == nullptr) {
+        return NetdListener::SendMsgFailCode;
+    }
+    return netdl->sendMsgAsync(msg, did, user);
+}
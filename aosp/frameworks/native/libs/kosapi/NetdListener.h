@@ -18,10 +18,15 @@
 #define _NETDLISTENER_H__
 
 #include <map>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 #include <sysutils/FrameworkListener.h>
 #include <utils/Errors.h>
 #include <kosapi/net.h>
-#include "webrtc/rtc_base/event.h"
 
 class NetdListener : public SocketListener {
 public:
@@ -29,6 +34,7 @@ public:
     static const int CMD_ARGS_MAX = 26;
     static const int CMDNUM_MIN = 1;
     static const int CMDNUM_MAX = INT_MAX;
+    static const int RESP_TIMEOUT_MS = 3000;
     int mCmdNum;
 
     NetdListener(int sock);
@@ -37,7 +43,11 @@ public:
     static void dumpArgs(int argc, char **argv, int argObscure);
     static int sendGenericOkFail(SocketClient *cli, int cond);
 
+    // Any number of commands can be in flight, every one is completed by its cmdNum.
+    // Fail at once in listener's thread, it is the one that would complete it.
     int sendMsg(const char* msg, char* resp, int maxBytes);
+    // Return cmdNum, or SendMsgFailCode and did won't be called.
+    int sendMsgAsync(const char* msg, fkosNetSendMsgDid did, void* user);
     void setNetReceiveBroadcast(fkosNetReceiveBroadcast did, void* user) {
         mNetReceiveBroadcast = did;
         mNetReceiveBroadcastUser = user;
@@ -53,21 +63,39 @@ private:
     bool mWithSeq;
     fkosNetReceiveBroadcast mNetReceiveBroadcast;
     void* mNetReceiveBroadcastUser;
-    rtc::Event mRespEvent;
 
     struct tslot {
-        tslot(char* _result, int _maxBytes)
-            : result(_result)
-            , maxBytes(_maxBytes)
-            , code(0)
-        {}
+        tslot(char* _result, int _maxBytes, fkosNetSendMsgDid _did, void* _user);
+        ~tslot();
 
         char* result;
         int maxBytes;
         int code;
+        bool done;
+        struct timespec deadline; // CLOCK_MONOTONIC
+        // sync: sendMsg waits on it, slot is on its stack.
+        pthread_cond_t cond;
+        // async: slot is on heap, result points to asyncResult.
+        fkosNetSendMsgDid did;
+        void* user;
+        std::vector<char> asyncResult;
     };
-    std::map<int, tslot>    mSlots;
+    // protected by mSlotsLock.
+    std::map<int, tslot*>   mSlots;
     pthread_mutex_t         mSlotsLock;
+
+    // tid of listener's thread, 0 until it reads first data.
+    std::atomic<pid_t>      mListenerTid;
+
+    // Time out async slots that netd doesn't respond, runs while there is any async slot.
+    std::thread             mExpireThread;
+    bool                    mExpireThreadRunning;
+    bool                    mStopping;
+    pthread_cond_t          mExpireCond;
+
+    int registerSlotLocked(tslot* slot);
+    bool sendCmd(int cmdNum, const char* msg);
+    void expireAsyncSlots();
 };
 
 #endif
@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -28,6 +29,7 @@
 #include <sys/limits.h>
 #include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/utsname.h>
 #include <unistd.h>
 
@@ -39,6 +41,7 @@
 
 #include <cutils/properties.h>
 #include <openssl/sha.h>
+#include <utils/Timers.h>
 
 #include <input/KeyLayoutMap.h>
 #include <input/KeyCharacterMap.h>
@@ -58,6 +61,19 @@ using namespace android;
 
 static const char *DEVICE_PATH = "/dev/input";
 
+// In cache directory of the app that loads libkosapi, see getProbeCachePath.
+static const char *PROBE_CACHE_NAME = "kosapi-input-probes";
+static const char *PROBE_CACHE_HEADER = "kosapi-input-probes";
+static const char *PROBE_CACHE_VERSION = "2";
+
+// Key maps are searched in these directories of ANDROID_ROOT and ANDROID_DATA.
+static const char *CONFIGURATION_ROOT_DIRS[] = {
+    "/usr/keylayout", "/usr/keychars", "/usr/idc",
+};
+static const char *CONFIGURATION_DATA_DIRS[] = {
+    "/system/devices/keylayout", "/system/devices/keychars", "/system/devices/idc",
+};
+
 /* return the larger integer */
 static inline int max(int v1, int v2)
 {
@@ -82,6 +98,152 @@ static String8 sha1(const String8& in) {
     return out;
 }
 
+// mtime of path in nanoseconds, -1 if it doesn't exist.
+static nsecs_t getFileMtime(const String8& path) {
+    struct stat st;
+    if (path.isEmpty() || stat(path.string(), &st)) {
+        return -1;
+    }
+    return nsecs_t(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+static void getConfigurationDirMtimes(Vector<nsecs_t>& outMtimes) {
+    const char* root = getenv("ANDROID_ROOT");
+    const char* data = getenv("ANDROID_DATA");
+    outMtimes.clear();
+    for (size_t i = 0; i < sizeof(CONFIGURATION_ROOT_DIRS) / sizeof(CONFIGURATION_ROOT_DIRS[0]); i++) {
+        String8 path(root ? root : "/system");
+        path.append(CONFIGURATION_ROOT_DIRS[i]);
+        outMtimes.push(getFileMtime(path));
+    }
+    for (size_t i = 0; i < sizeof(CONFIGURATION_DATA_DIRS) / sizeof(CONFIGURATION_DATA_DIRS[0]); i++) {
+        String8 path(data ? data : "/data");
+        path.append(CONFIGURATION_DATA_DIRS[i]);
+        outMtimes.push(getFileMtime(path));
+    }
+}
+
+static bool sameMtimes(const Vector<nsecs_t>& a, const Vector<nsecs_t>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Identify a device model for probe cache. Name is included, virtual devices often share vendor and product.
+// Descriptor isn't, it differs between two units of one model and gets a nonce when they collide,
+// while their capabilities and key maps are the same.
+static String8 getProbeKey(const InputDeviceIdentifier& identifier, int driverVersion) {
+    String8 key;
+    key.appendFormat("%04x:%04x:%04x:%04x:%08x:%s", identifier.bus, identifier.vendor,
+            identifier.product, identifier.version, driverVersion, identifier.name.string());
+    return key;
+}
+
+// /data/data/<package>/cache/kosapi-input-probes, package is process name without ":service" suffix.
+// Empty if process isn't an app, probes are kept in memory only then.
+static String8 getProbeCachePath() {
+    char name[128];
+    FILE* fp = fopen("/proc/self/cmdline", "r");
+    if (fp == NULL) {
+        return String8();
+    }
+    const size_t size = fread(name, 1, sizeof(name) - 1, fp);
+    fclose(fp);
+    name[size] = '\0';
+    char* colon = strchr(name, ':');
+    if (colon != NULL) {
+        *colon = '\0';
+    }
+    if (strchr(name, '.') == NULL || strchr(name, '/') != NULL) {
+        return String8();
+    }
+    String8 dir;
+    dir.appendFormat("/data/data/%s/cache", name);
+    if (access(dir.string(), W_OK)) {
+        return String8();
+    }
+    return dir.appendPath(PROBE_CACHE_NAME);
+}
+
+static String8 getVirtualKeyMapPath(const InputDeviceIdentifier& identifier) {
+    String8 path;
+    path.append("/sys/board_properties/virtualkeys.");
+    path.append(identifier.name);
+    return path;
+}
+
+static void appendHex(String8& out, const uint8_t* bytes, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        out.appendFormat("%02x", bytes[i]);
+    }
+}
+
+static bool parseHex(const char* in, uint8_t* bytes, size_t size) {
+    if (strlen(in) != size * 2) {
+        return false;
+    }
+    for (size_t i = 0; i < size; i++) {
+        unsigned int value;
+        if (!isxdigit(in[i * 2]) || !isxdigit(in[i * 2 + 1])
+                || sscanf(in + i * 2, "%2x", &value) != 1) {
+            return false;
+        }
+        bytes[i] = uint8_t(value);
+    }
+    return true;
+}
+
+// Read a line of "<name> <value>", return value. NULL if it is end of file or another name.
+static const char* readField(FILE* fp, const char* name, char* line, size_t size) {
+    if (!fgets(line, size, fp)) {
+        return NULL;
+    }
+    size_t len = strlen(line);
+    if (len == 0 || line[len - 1] != '\n') {
+        return NULL;
+    }
+    line[len - 1] = '\0';
+    size_t nameLen = strlen(name);
+    if (strncmp(line, name, nameLen) || line[nameLen] != ' ') {
+        return NULL;
+    }
+    return line + nameLen + 1;
+}
+
+static bool readHexField(FILE* fp, const char* name, char* line, size_t size,
+        uint8_t* bytes, size_t bytesSize) {
+    const char* value = readField(fp, name, line, size);
+    return value && parseHex(value, bytes, bytesSize);
+}
+
+// "<mtime> <path>", path may be empty.
+static bool readFileField(FILE* fp, const char* name, char* line, size_t size,
+        String8* outPath, nsecs_t* outMtime) {
+    const char* value = readField(fp, name, line, size);
+    if (!value) {
+        return false;
+    }
+    char* end;
+    *outMtime = strtoll(value, &end, 10);
+    if (end == value || *end != ' ') {
+        return false;
+    }
+    outPath->setTo(end + 1);
+    return true;
+}
+
+static void writeHexField(FILE* fp, const char* name, const uint8_t* bytes, size_t size) {
+    String8 hex;
+    appendHex(hex, bytes, size);
+    fprintf(fp, "%s %s\n", name, hex.string());
+}
+
 // --- Global Functions ---
 
 uint32_t getAbsAxisUsage(int32_t axis, uint32_t deviceClasses) {
@@ -131,7 +293,7 @@ EventHub::Device::Device(int fd, int32_t id, const String8& path,
         fd(fd), id(id), path(path), identifier(identifier),
         classes(0), configuration(NULL), virtualKeyMap(NULL),
         ffEffectPlaying(false), ffEffectId(-1), controllerNumber(0),
-        timestampOverrideSec(0), timestampOverrideUsec(0) {
+        timestampOverrideSec(0), timestampOverrideUsec(0), rawEventSeq(0), probeCached(false) {
     ALOGD("EventHub::Device::Device--- id: %i", id);
     memset(keyBitmask, 0, sizeof(keyBitmask));
     memset(absBitmask, 0, sizeof(absBitmask));
@@ -159,14 +321,77 @@ void EventHub::Device::close() {
 }
 
 
+// --- RawEventRing ---
+
+const size_t RawEventRing::kCapacity;
+
+RawEventRing::RawEventRing() :
+        mLastSeq(0) {
+    for (size_t i = 0; i < kCapacity; i++) {
+        mSlots[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+void RawEventRing::publish(RawInputEvent& event) {
+    // seqlock: slot's seq is 0 while it is being written, reader that sees different seq before and after copy retries.
+    const uint64_t seq = mLastSeq.load(std::memory_order_relaxed) + 1;
+    event.seq = seq;
+    Slot& slot = mSlots[seq & (kCapacity - 1)];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.event = event;
+    slot.seq.store(seq, std::memory_order_release);
+    mLastSeq.store(seq, std::memory_order_release);
+}
+
+bool RawEventRing::read(uint64_t seq, RawInputEvent* outEvent) const {
+    const Slot& slot = mSlots[seq & (kCapacity - 1)];
+    if (slot.seq.load(std::memory_order_acquire) != seq) {
+        return false;
+    }
+    *outEvent = slot.event;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == seq;
+}
+
+// --- RawEventSubscriber ---
+
+RawEventSubscriber::RawEventSubscriber(const RawEventRing& ring) :
+        mRing(ring), mNextSeq(ring.lastSeq() + 1), mLost(0) {
+}
+
+size_t RawEventSubscriber::read(RawInputEvent* outEvents, size_t max) {
+    size_t count = 0;
+    while (count < max) {
+        const uint64_t lastSeq = mRing.lastSeq();
+        if (mNextSeq > lastSeq) {
+            break;
+        }
+        if (lastSeq - mNextSeq >= RawEventRing::kCapacity) {
+            const uint64_t oldestSeq = lastSeq - RawEventRing::kCapacity + 1;
+            mLost += oldestSeq - mNextSeq;
+            mNextSeq = oldestSeq;
+        }
+        // if producer overwrites it while copying, retry with new lastSeq.
+        if (mRing.read(mNextSeq, &outEvents[count])) {
+            count++;
+            mNextSeq++;
+        }
+    }
+    return count;
+}
+
 // --- EventHub ---
 
 const uint32_t EventHub::EPOLL_ID_INOTIFY;
+const uint32_t EventHub::EPOLL_ID_WAKE;
 const int EventHub::EPOLL_SIZE_HINT;
 const int EventHub::EPOLL_MAX_EVENTS;
 
 EventHub::EventHub(void) :
         mBuiltInKeyboardId(NO_BUILT_IN_KEYBOARD), mNextDeviceId(1), mControllerNumbers(),
+        mProbeCachePath(getProbeCachePath()), mProbesLoaded(false), mProbesDirty(false),
+        mExitPending(false), mLogEvents(false),
         mPendingEventCount(0), mPendingEventIndex(0), mPendingINotify(false)
 {
     ALOGD("EventHub::EventHub---");
@@ -184,15 +409,41 @@ EventHub::EventHub(void) :
     eventItem.data.u32 = EPOLL_ID_INOTIFY;
     result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mINotifyFd, &eventItem);
     LOG_ALWAYS_FATAL_IF(result != 0, "Could not add INotify to epoll instance.  errno=%d", errno);
+
+    int wakeFds[2];
+    result = pipe(wakeFds);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not create wake pipe.  errno=%d", errno);
+
+    mWakeReadPipeFd = wakeFds[0];
+    mWakeWritePipeFd = wakeFds[1];
+
+    result = fcntl(mWakeReadPipeFd, F_SETFL, O_NONBLOCK);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not make wake read pipe non-blocking.  errno=%d",
+            errno);
+
+    result = fcntl(mWakeWritePipeFd, F_SETFL, O_NONBLOCK);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not make wake write pipe non-blocking.  errno=%d",
+            errno);
+
+    eventItem.data.u32 = EPOLL_ID_WAKE;
+    result = epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeReadPipeFd, &eventItem);
+    LOG_ALWAYS_FATAL_IF(result != 0, "Could not add wake read pipe to epoll instance.  errno=%d",
+            errno);
+
+    char value[PROPERTY_VALUE_MAX];
+    mLogEvents = property_get("kos.eventhub.log", value, "0") > 0 && atoi(value) != 0;
     ALOGD("---EventHub::EventHub X");
 }
 
 EventHub::~EventHub(void) {
     ALOGD("EventHub::~EventHub---");
+    stop();
     closeAllDevicesLocked();
 
     ::close(mEpollFd);
     ::close(mINotifyFd);
+    ::close(mWakeReadPipeFd);
+    ::close(mWakeWritePipeFd);
 
     // release_wake_lock(WAKE_LOCK_ID);
     ALOGD("---EventHub::~EventHub X");
@@ -220,111 +471,15 @@ static const int32_t GAMEPAD_KEYCODES[] = {
         AKEYCODE_BUTTON_START, AKEYCODE_BUTTON_SELECT, AKEYCODE_BUTTON_MODE,
 };
 
-status_t EventHub::openDeviceLocked(const char *devicePath) {
-    char buffer[80];
-
-    ALOGV("Opening device: %s", devicePath);
-
-    int fd = open(devicePath, O_RDWR | O_CLOEXEC);
-    if(fd < 0) {
-        ALOGE("could not open %s, %s\n", devicePath, strerror(errno));
-        return -1;
-    }
-
-    InputDeviceIdentifier identifier;
-
-    // Get device name.
-    if(ioctl(fd, EVIOCGNAME(sizeof(buffer) - 1), &buffer) < 1) {
-        //fprintf(stderr, "could not get device name for %s, %s\n", devicePath, strerror(errno));
-    } else {
-        buffer[sizeof(buffer) - 1] = '\0';
-        identifier.name.setTo(buffer);
-    }
-/*
-    // Check to see if the device is on our excluded list
-    for (size_t i = 0; i < mExcludedDevices.size(); i++) {
-        const String8& item = mExcludedDevices.itemAt(i);
-        if (identifier.name == item) {
-            ALOGI("ignoring event id %s driver %s\n", devicePath, item.string());
-            close(fd);
-            return -1;
-        }
-    }
-*/
-    // Get device driver version.
-    int driverVersion;
-    if(ioctl(fd, EVIOCGVERSION, &driverVersion)) {
-        ALOGE("could not get driver version for %s, %s\n", devicePath, strerror(errno));
-        close(fd);
-        return -1;
-    }
-
-    // Get device identifier.
-    struct input_id inputId;
-    if(ioctl(fd, EVIOCGID, &inputId)) {
-        ALOGE("could not get device input id for %s, %s\n", devicePath, strerror(errno));
-        close(fd);
-        return -1;
-    }
-    identifier.bus = inputId.bustype;
-    identifier.product = inputId.product;
-    identifier.vendor = inputId.vendor;
-    identifier.version = inputId.version;
-
-    // Get device physical location.
-    if(ioctl(fd, EVIOCGPHYS(sizeof(buffer) - 1), &buffer) < 1) {
-        //fprintf(stderr, "could not get location for %s, %s\n", devicePath, strerror(errno));
-    } else {
-        buffer[sizeof(buffer) - 1] = '\0';
-        identifier.location.setTo(buffer);
-    }
-
-    // Get device unique id.
-    if(ioctl(fd, EVIOCGUNIQ(sizeof(buffer) - 1), &buffer) < 1) {
-        //fprintf(stderr, "could not get idstring for %s, %s\n", devicePath, strerror(errno));
-    } else {
-        buffer[sizeof(buffer) - 1] = '\0';
-        identifier.uniqueId.setTo(buffer);
-    }
-
-    // Fill in the descriptor.
-    assignDescriptorLocked(identifier);
-
-    // Make file descriptor non-blocking for use with poll().
-    if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
-        ALOGE("Error %d making device file descriptor non-blocking.", errno);
-        close(fd);
-        return -1;
-    }
-
-    // Allocate device.  (The device object takes ownership of the fd at this point.)
-    int32_t deviceId = mNextDeviceId++;
-    Device* device = new Device(fd, deviceId, String8(devicePath), identifier);
-
-    ALOGV("add device %d: %s\n", deviceId, devicePath);
-    ALOGV("  bus:        %04x\n"
-         "  vendor      %04x\n"
-         "  product     %04x\n"
-         "  version     %04x\n",
-        identifier.bus, identifier.vendor, identifier.product, identifier.version);
-    ALOGV("  name:       \"%s\"\n", identifier.name.string());
-    ALOGV("  location:   \"%s\"\n", identifier.location.string());
-    ALOGV("  unique id:  \"%s\"\n", identifier.uniqueId.string());
-    ALOGV("  descriptor: \"%s\"\n", identifier.descriptor.string());
-    ALOGV("  driver:     v%d.%d.%d\n",
-        driverVersion >> 16, (driverVersion >> 8) & 0xff, driverVersion & 0xff);
-
-    // Load the configuration file for the device.
-    // loadConfigurationLocked(device);
-
+status_t EventHub::probeDeviceLocked(Device* device) {
     // Figure out the kinds of events the device reports.
-    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(device->keyBitmask)), device->keyBitmask);
-    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(device->absBitmask)), device->absBitmask);
-    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(device->relBitmask)), device->relBitmask);
-    ioctl(fd, EVIOCGBIT(EV_SW, sizeof(device->swBitmask)), device->swBitmask);
-    ioctl(fd, EVIOCGBIT(EV_LED, sizeof(device->ledBitmask)), device->ledBitmask);
-    ioctl(fd, EVIOCGBIT(EV_FF, sizeof(device->ffBitmask)), device->ffBitmask);
-    ioctl(fd, EVIOCGPROP(sizeof(device->propBitmask)), device->propBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_KEY, sizeof(device->keyBitmask)), device->keyBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_ABS, sizeof(device->absBitmask)), device->absBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_REL, sizeof(device->relBitmask)), device->relBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_SW, sizeof(device->swBitmask)), device->swBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_LED, sizeof(device->ledBitmask)), device->ledBitmask);
+    ioctl(device->fd, EVIOCGBIT(EV_FF, sizeof(device->ffBitmask)), device->ffBitmask);
+    ioctl(device->fd, EVIOCGPROP(sizeof(device->propBitmask)), device->propBitmask);
 
     // See if this is a keyboard.  Ignore everything in the button range except for
     // joystick and gamepad buttons which are handled like keyboards for the most part.
@@ -429,16 +584,8 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
         keyMapStatus = loadKeyMapLocked(device);
     }
 
-    // Configure the keyboard, gamepad or virtual keyboard.
+    // Find out what kind of keyboard it is.
     if (device->classes & INPUT_DEVICE_CLASS_KEYBOARD) {
-        // Register the keyboard as a built-in keyboard if it is eligible.
-        if (!keyMapStatus
-                && mBuiltInKeyboardId == NO_BUILT_IN_KEYBOARD
-                && isEligibleBuiltInKeyboard(device->identifier,
-                        device->configuration, &device->keyMap)) {
-            mBuiltInKeyboardId = device->id;
-        }
-
         // 'Q' key support = cheap test of whether this is an alpha-capable kbd
         if (hasKeycodeLocked(device, AKEYCODE_Q)) {
             device->classes |= INPUT_DEVICE_CLASS_ALPHAKEY;
@@ -460,6 +607,127 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
                 break;
             }
         }
+    }
+
+    return keyMapStatus;
+}
+
+status_t EventHub::openDeviceLocked(const char *devicePath) {
+    char buffer[80];
+
+    ALOGV("Opening device: %s", devicePath);
+
+    int fd = open(devicePath, O_RDWR | O_CLOEXEC);
+    if(fd < 0) {
+        ALOGE("could not open %s, %s\n", devicePath, strerror(errno));
+        return -1;
+    }
+
+    InputDeviceIdentifier identifier;
+
+    // Get device name.
+    if(ioctl(fd, EVIOCGNAME(sizeof(buffer) - 1), &buffer) < 1) {
+        //fprintf(stderr, "could not get device name for %s, %s\n", devicePath, strerror(errno));
+    } else {
+        buffer[sizeof(buffer) - 1] = '\0';
+        identifier.name.setTo(buffer);
+    }
+/*
+    // Check to see if the device is on our excluded list
+    for (size_t i = 0; i < mExcludedDevices.size(); i++) {
+        const String8& item = mExcludedDevices.itemAt(i);
+        if (identifier.name == item) {
+            ALOGI("ignoring event id %s driver %s\n", devicePath, item.string());
+            close(fd);
+            return -1;
+        }
+    }
+*/
+    // Get device driver version.
+    int driverVersion;
+    if(ioctl(fd, EVIOCGVERSION, &driverVersion)) {
+        ALOGE("could not get driver version for %s, %s\n", devicePath, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    // Get device identifier.
+    struct input_id inputId;
+    if(ioctl(fd, EVIOCGID, &inputId)) {
+        ALOGE("could not get device input id for %s, %s\n", devicePath, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    identifier.bus = inputId.bustype;
+    identifier.product = inputId.product;
+    identifier.vendor = inputId.vendor;
+    identifier.version = inputId.version;
+
+    // Get device physical location.
+    if(ioctl(fd, EVIOCGPHYS(sizeof(buffer) - 1), &buffer) < 1) {
+        //fprintf(stderr, "could not get location for %s, %s\n", devicePath, strerror(errno));
+    } else {
+        buffer[sizeof(buffer) - 1] = '\0';
+        identifier.location.setTo(buffer);
+    }
+
+    // Get device unique id.
+    if(ioctl(fd, EVIOCGUNIQ(sizeof(buffer) - 1), &buffer) < 1) {
+        //fprintf(stderr, "could not get idstring for %s, %s\n", devicePath, strerror(errno));
+    } else {
+        buffer[sizeof(buffer) - 1] = '\0';
+        identifier.uniqueId.setTo(buffer);
+    }
+
+    // Fill in the descriptor.
+    assignDescriptorLocked(identifier);
+
+    // Make file descriptor non-blocking for use with poll().
+    if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
+        ALOGE("Error %d making device file descriptor non-blocking.", errno);
+        close(fd);
+        return -1;
+    }
+
+    // Allocate device.  (The device object takes ownership of the fd at this point.)
+    int32_t deviceId = mNextDeviceId++;
+    Device* device = new Device(fd, deviceId, String8(devicePath), identifier);
+
+    ALOGV("add device %d: %s\n", deviceId, devicePath);
+    ALOGV("  bus:        %04x\n"
+         "  vendor      %04x\n"
+         "  product     %04x\n"
+         "  version     %04x\n",
+        identifier.bus, identifier.vendor, identifier.product, identifier.version);
+    ALOGV("  name:       \"%s\"\n", identifier.name.string());
+    ALOGV("  location:   \"%s\"\n", identifier.location.string());
+    ALOGV("  unique id:  \"%s\"\n", identifier.uniqueId.string());
+    ALOGV("  descriptor: \"%s\"\n", identifier.descriptor.string());
+    ALOGV("  driver:     v%d.%d.%d\n",
+        driverVersion >> 16, (driverVersion >> 8) & 0xff, driverVersion & 0xff);
+
+    // Load the configuration file for the device.
+    // loadConfigurationLocked(device);
+
+    // Figure out the kinds of events the device reports and load its key maps.
+    // Reuse the last probe of the same device if any, it may be made by a previous process.
+    String8 probeKey = getProbeKey(identifier, driverVersion);
+    status_t keyMapStatus;
+    device->probeCached = applyProbeLocked(device, probeKey, &keyMapStatus);
+    if (!device->probeCached) {
+        keyMapStatus = probeDeviceLocked(device);
+        addProbeLocked(device, probeKey);
+    }
+
+    // Configure the keyboard, gamepad or virtual keyboard.
+    if (device->classes & INPUT_DEVICE_CLASS_KEYBOARD) {
+        // Register the keyboard as a built-in keyboard if it is eligible.
+        if (!keyMapStatus
+                && mBuiltInKeyboardId == NO_BUILT_IN_KEYBOARD
+                && isEligibleBuiltInKeyboard(device->identifier,
+                        device->configuration, &device->keyMap)) {
+            mBuiltInKeyboardId = device->id;
+        }
 
         // Disable kernel key repeat since we handle it ourselves
         unsigned int repeatRate[] = {0,0};
@@ -491,7 +759,6 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
         device->controllerNumber = getNextControllerNumberLocked(device);
         // setLedForController(device);
     }
-/*
     // Register with epoll.
     struct epoll_event eventItem;
     memset(&eventItem, 0, sizeof(eventItem));
@@ -502,7 +769,7 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
         delete device;
         return -1;
     }
-
+/*
     String8 wakeMechanism("EPOLLWAKEUP");
     if (!mUsingEpollWakeup) {
 #ifndef EVIOCSSUSPENDBLOCK
@@ -538,14 +805,14 @@ status_t EventHub::openDeviceLocked(const char *devicePath) {
 
     ALOGI("New device: id=%d, fd=%d, path='%s', name='%s', classes=0x%x, "
             "configuration='%s', keyLayout='%s', keyCharacterMap='%s', builtinKeyboard=%s, "
-            "usingClockIoctl=%s",
+            "usingClockIoctl=%s, probeCached=%s",
          deviceId, fd, devicePath, device->identifier.name.string(),
          device->classes,
          device->configurationFile.string(),
          device->keyMap.keyLayoutFile.string(),
          device->keyMap.keyCharacterMapFile.string(),
          toString(mBuiltInKeyboardId == deviceId),
-         toString(usingClockIoctl));
+         toString(usingClockIoctl), toString(device->probeCached));
 
     addDeviceLocked(device);
     return 0;
@@ -640,9 +907,7 @@ void EventHub::addDeviceLocked(Device* device) {
 
 status_t EventHub::loadVirtualKeyMapLocked(Device* device) {
     // The virtual key map is supplied by the kernel as a system board property file.
-    String8 path;
-    path.append("/sys/board_properties/virtualkeys.");
-    path.append(device->identifier.name);
+    String8 path = getVirtualKeyMapPath(device->identifier);
     if (access(path.string(), R_OK)) {
         return NAME_NOT_FOUND;
     }
@@ -694,10 +959,12 @@ void EventHub::releaseControllerNumberLocked(Device* device) {
 }
 
 void EventHub::scanDevicesLocked() {
+    refreshProbesLocked();
     status_t res = scanDirLocked(DEVICE_PATH);
     if(res < 0) {
         ALOGE("scan dir failed for %s\n", DEVICE_PATH);
     }
+    saveProbesLocked();
 /*
     if (mDevices.indexOfKey(VIRTUAL_KEYBOARD_ID) < 0) {
         createVirtualKeyboardLocked();
@@ -749,13 +1016,13 @@ void EventHub::closeDeviceLocked(Device* device) {
                 device->path.string(), mBuiltInKeyboardId);
         mBuiltInKeyboardId = NO_BUILT_IN_KEYBOARD;
     }
-/*
+
     if (!device->isVirtual()) {
         if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, device->fd, NULL)) {
             ALOGW("Could not remove device fd from epoll instance.  errno=%d", errno);
         }
     }
-*/
+
     releaseControllerNumberLocked(device);
 
     mDevices.removeItem(device->id);
@@ -787,6 +1054,7 @@ status_t EventHub::readNotifyLocked() {
     filename = devname + strlen(devname);
     *filename++ = '/';
 
+    refreshProbesLocked();
     while(res >= (int)sizeof(*event)) {
         event = (struct inotify_event *)(event_buf + event_pos);
         //printf("%d: %08x \"%s\"\n", event->wd, event->mask, event->len ? event->name : "");
@@ -803,6 +1071,7 @@ status_t EventHub::readNotifyLocked() {
         res -= event_size;
         event_pos += event_size;
     }
+    saveProbesLocked();
     return 0;
 }
 
@@ -830,22 +1099,319 @@ status_t EventHub::scanDirLocked(const char *dirname)
     return 0;
 }
 
+// --- Device probe cache ---
+
+bool EventHub::applyProbeLocked(Device* device, const String8& probeKey,
+        status_t* outKeyMapStatus) {
+    ssize_t index = mProbes.indexOfKey(probeKey);
+    if (index < 0) {
+        return false;
+    }
+    const DeviceProbe& probe = mProbes.valueAt(index);
+    if (getFileMtime(probe.keyLayoutFile) != probe.keyLayoutMtime
+            || getFileMtime(probe.keyCharacterMapFile) != probe.keyCharacterMapMtime
+            || getFileMtime(probe.virtualKeyMapFile) != probe.virtualKeyMapMtime) {
+        ALOGI("Key maps of %s changed, probe it again.", device->identifier.name.string());
+        removeProbeLocked(index);
+        return false;
+    }
+
+    status_t status = OK;
+    if (!probe.virtualKeyMapFile.isEmpty()) {
+        status = VirtualKeyMap::load(probe.virtualKeyMapFile, &device->virtualKeyMap);
+    }
+    if (!status && !probe.keyLayoutFile.isEmpty()) {
+        status = getKeyLayoutMapLocked(probe.keyLayoutFile, &device->keyMap.keyLayoutMap);
+        device->keyMap.keyLayoutFile = probe.keyLayoutFile;
+    }
+    if (!status && !probe.keyCharacterMapFile.isEmpty()) {
+        status = getKeyCharacterMapLocked(probe.keyCharacterMapFile,
+                &device->keyMap.keyCharacterMap);
+        device->keyMap.keyCharacterMapFile = probe.keyCharacterMapFile;
+    }
+    if (status) {
+        ALOGW("Could not load key maps of %s from its probe, probe it again.",
+                device->identifier.name.string());
+        removeProbeLocked(index);
+
+        delete device->virtualKeyMap;
+        device->virtualKeyMap = NULL;
+        device->keyMap = KeyMap();
+        return false;
+    }
+
+    memcpy(device->keyBitmask, probe.keyBitmask, sizeof(device->keyBitmask));
+    memcpy(device->absBitmask, probe.absBitmask, sizeof(device->absBitmask));
+    memcpy(device->relBitmask, probe.relBitmask, sizeof(device->relBitmask));
+    memcpy(device->swBitmask, probe.swBitmask, sizeof(device->swBitmask));
+    memcpy(device->ledBitmask, probe.ledBitmask, sizeof(device->ledBitmask));
+    memcpy(device->ffBitmask, probe.ffBitmask, sizeof(device->ffBitmask));
+    memcpy(device->propBitmask, probe.propBitmask, sizeof(device->propBitmask));
+    device->classes = probe.classes;
+
+    // Same as KeyMap::load.
+    *outKeyMapStatus = device->keyMap.isComplete() ? OK : NAME_NOT_FOUND;
+    return true;
+}
+
+void EventHub::addProbeLocked(Device* device, const String8& probeKey) {
+    DeviceProbe probe;
+    probe.classes = device->classes;
+    memcpy(probe.keyBitmask, device->keyBitmask, sizeof(probe.keyBitmask));
+    memcpy(probe.absBitmask, device->absBitmask, sizeof(probe.absBitmask));
+    memcpy(probe.relBitmask, device->relBitmask, sizeof(probe.relBitmask));
+    memcpy(probe.swBitmask, device->swBitmask, sizeof(probe.swBitmask));
+    memcpy(probe.ledBitmask, device->ledBitmask, sizeof(probe.ledBitmask));
+    memcpy(probe.ffBitmask, device->ffBitmask, sizeof(probe.ffBitmask));
+    memcpy(probe.propBitmask, device->propBitmask, sizeof(probe.propBitmask));
+
+    const KeyMap& keyMap = device->keyMap;
+    if (keyMap.haveKeyLayout()) {
+        probe.keyLayoutFile = keyMap.keyLayoutFile;
+        mKeyLayoutMaps.add(keyMap.keyLayoutFile, keyMap.keyLayoutMap);
+    }
+    if (keyMap.haveKeyCharacterMap()) {
+        probe.keyCharacterMapFile = keyMap.keyCharacterMapFile;
+        mKeyCharacterMaps.add(keyMap.keyCharacterMapFile, keyMap.keyCharacterMap);
+    }
+    if (device->virtualKeyMap) {
+        probe.virtualKeyMapFile = getVirtualKeyMapPath(device->identifier);
+    }
+    probe.keyLayoutMtime = getFileMtime(probe.keyLayoutFile);
+    probe.keyCharacterMapMtime = getFileMtime(probe.keyCharacterMapFile);
+    probe.virtualKeyMapMtime = getFileMtime(probe.virtualKeyMapFile);
+
+    mProbes.add(probeKey, probe);
+    mProbesDirty = true;
+}
+
+void EventHub::removeProbeLocked(size_t index) {
+    const DeviceProbe& probe = mProbes.valueAt(index);
+    // The files may be changed, don't share what was parsed from them.
+    mKeyLayoutMaps.removeItem(probe.keyLayoutFile);
+    mKeyCharacterMaps.removeItem(probe.keyCharacterMapFile);
+    mProbes.removeItemsAt(index);
+    mProbesDirty = true;
+}
+
+status_t EventHub::getKeyLayoutMapLocked(const String8& path, sp<KeyLayoutMap>* outMap) {
+    ssize_t index = mKeyLayoutMaps.indexOfKey(path);
+    if (index >= 0) {
+        *outMap = mKeyLayoutMaps.valueAt(index);
+        return OK;
+    }
+    status_t status = KeyLayoutMap::load(path, outMap);
+    if (!status) {
+        mKeyLayoutMaps.add(path, *outMap);
+    }
+    return status;
+}
+
+status_t EventHub::getKeyCharacterMapLocked(const String8& path, sp<KeyCharacterMap>* outMap) {
+    ssize_t index = mKeyCharacterMaps.indexOfKey(path);
+    if (index >= 0) {
+        *outMap = mKeyCharacterMaps.valueAt(index);
+        return OK;
+    }
+    status_t status = KeyCharacterMap::load(path, KeyCharacterMap::FORMAT_BASE, outMap);
+    if (!status) {
+        mKeyCharacterMaps.add(path, *outMap);
+    }
+    return status;
+}
+
+void EventHub::refreshProbesLocked() {
+    Vector<nsecs_t> dirMtimes;
+    getConfigurationDirMtimes(dirMtimes);
+    if (!mProbesLoaded) {
+        mProbesLoaded = true;
+        mConfigurationDirMtimes = dirMtimes;
+        loadProbesLocked();
+        return;
+    }
+    if (!sameMtimes(dirMtimes, mConfigurationDirMtimes)) {
+        // A key map is added or removed, a device may resolve to another file.
+        ALOGI("Key map directories changed, drop %zu device probes.", mProbes.size());
+        mConfigurationDirMtimes = dirMtimes;
+        mProbes.clear();
+        mKeyLayoutMaps.clear();
+        mKeyCharacterMaps.clear();
+        mProbesDirty = true;
+    }
+}
+
+void EventHub::loadProbesLocked() {
+    if (mProbeCachePath.isEmpty()) {
+        return;
+    }
+    FILE* fp = fopen(mProbeCachePath.string(), "r");
+    if (fp == NULL) {
+        return;
+    }
+
+    char line[PATH_MAX + 64];
+    const char* value = readField(fp, PROBE_CACHE_HEADER, line, sizeof(line));
+    bool valid = false;
+    if (value && !strcmp(value, PROBE_CACHE_VERSION)) {
+        value = readField(fp, "dirs", line, sizeof(line));
+    } else {
+        value = NULL;
+    }
+    if (value) {
+        // Key maps may be changed while no one is running.
+        Vector<nsecs_t> dirMtimes;
+        char* end;
+        for (nsecs_t mtime = strtoll(value, &end, 10); end != value;
+                mtime = strtoll(value, &end, 10)) {
+            dirMtimes.push(mtime);
+            value = end;
+        }
+        valid = *value == '\0' && sameMtimes(dirMtimes, mConfigurationDirMtimes);
+    }
+
+    while (valid) {
+        value = readField(fp, "device", line, sizeof(line));
+        if (!value) {
+            valid = feof(fp);
+            break;
+        }
+        String8 probeKey(value);
+        DeviceProbe probe;
+        value = readField(fp, "classes", line, sizeof(line));
+        valid = value && sscanf(value, "%x", &probe.classes) == 1
+                && readHexField(fp, "key", line, sizeof(line),
+                        probe.keyBitmask, sizeof(probe.keyBitmask))
+                && readHexField(fp, "abs", line, sizeof(line),
+                        probe.absBitmask, sizeof(probe.absBitmask))
+                && readHexField(fp, "rel", line, sizeof(line),
+                        probe.relBitmask, sizeof(probe.relBitmask))
+                && readHexField(fp, "sw", line, sizeof(line),
+                        probe.swBitmask, sizeof(probe.swBitmask))
+                && readHexField(fp, "led", line, sizeof(line),
+                        probe.ledBitmask, sizeof(probe.ledBitmask))
+                && readHexField(fp, "ff", line, sizeof(line),
+                        probe.ffBitmask, sizeof(probe.ffBitmask))
+                && readHexField(fp, "prop", line, sizeof(line),
+                        probe.propBitmask, sizeof(probe.propBitmask))
+                && readFileField(fp, "kl", line, sizeof(line),
+                        &probe.keyLayoutFile, &probe.keyLayoutMtime)
+                && readFileField(fp, "kcm", line, sizeof(line),
+                        &probe.keyCharacterMapFile, &probe.keyCharacterMapMtime)
+                && readFileField(fp, "vkm", line, sizeof(line),
+                        &probe.virtualKeyMapFile, &probe.virtualKeyMapMtime);
+        if (valid) {
+            mProbes.add(probeKey, probe);
+        }
+    }
+    fclose(fp);
+
+    if (!valid) {
+        ALOGI("Probe cache %s is stale or corrupted, discard it.", mProbeCachePath.string());
+        mProbes.clear();
+        mProbesDirty = true;
+        return;
+    }
+    ALOGI("Loaded %zu device probes from %s", mProbes.size(), mProbeCachePath.string());
+}
+
+void EventHub::saveProbesLocked() {
+    if (!mProbesDirty || mProbeCachePath.isEmpty()) {
+        return;
+    }
+    mProbesDirty = false;
+
+    // Write a temporary file then rename, so a crash never leaves a half-written cache.
+    String8 tmpPath(mProbeCachePath);
+    tmpPath.append(".tmp");
+    FILE* fp = fopen(tmpPath.string(), "w");
+    if (fp == NULL) {
+        ALOGW("Could not create %s, %s", tmpPath.string(), strerror(errno));
+        return;
+    }
+
+    fprintf(fp, "%s %s\n", PROBE_CACHE_HEADER, PROBE_CACHE_VERSION);
+    fprintf(fp, "dirs");
+    for (size_t i = 0; i < mConfigurationDirMtimes.size(); i++) {
+        fprintf(fp, " %" PRId64, int64_t(mConfigurationDirMtimes[i]));
+    }
+    fprintf(fp, "\n");
+
+    for (size_t i = 0; i < mProbes.size(); i++) {
+        const DeviceProbe& probe = mProbes.valueAt(i);
+        fprintf(fp, "device %s\n", mProbes.keyAt(i).string());
+        fprintf(fp, "classes %x\n", probe.classes);
+        writeHexField(fp, "key", probe.keyBitmask, sizeof(probe.keyBitmask));
+        writeHexField(fp, "abs", probe.absBitmask, sizeof(probe.absBitmask));
+        writeHexField(fp, "rel", probe.relBitmask, sizeof(probe.relBitmask));
+        writeHexField(fp, "sw", probe.swBitmask, sizeof(probe.swBitmask));
+        writeHexField(fp, "led", probe.ledBitmask, sizeof(probe.ledBitmask));
+        writeHexField(fp, "ff", probe.ffBitmask, sizeof(probe.ffBitmask));
+        writeHexField(fp, "prop", probe.propBitmask, sizeof(probe.propBitmask));
+        fprintf(fp, "kl %" PRId64 " %s\n", int64_t(probe.keyLayoutMtime),
+                probe.keyLayoutFile.string());
+        fprintf(fp, "kcm %" PRId64 " %s\n", int64_t(probe.keyCharacterMapMtime),
+                probe.keyCharacterMapFile.string());
+        fprintf(fp, "vkm %" PRId64 " %s\n", int64_t(probe.virtualKeyMapMtime),
+                probe.virtualKeyMapFile.string());
+    }
+
+    bool ok = !ferror(fp);
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmpPath.string(), mProbeCachePath.string())) {
+        ALOGW("Could not save probe cache %s, %s", mProbeCachePath.string(), strerror(errno));
+        unlink(tmpPath.string());
+    }
+}
+
 void EventHub::start()
 {
-    scanDevicesLocked();
+    {
+        AutoMutex _l(mLock);
+        scanDevicesLocked();
+    }
+    if (mThread.joinable()) {
+        return;
+    }
+    mExitPending = false;
+    mThread = std::thread([this]() {
+        while (!mExitPending) {
+            loopOnce(-1);
+        }
+    });
+}
+
+void EventHub::stop()
+{
+    if (!mThread.joinable()) {
+        return;
+    }
+    mExitPending = true;
+    wake();
+    mThread.join();
+}
+
+void EventHub::wake()
+{
+    ssize_t nWrite;
+    do {
+        nWrite = write(mWakeWritePipeFd, "W", 1);
+    } while (nWrite == -1 && errno == EINTR);
+
+    if (nWrite != 1 && errno != EAGAIN) {
+        ALOGW("Could not write wake signal, errno=%d", errno);
+    }
 }
 
-void EventHub::loopOnce()
+void EventHub::loopOnce(int timeoutMillis)
 {
     size_t bufferSize = 256;
     struct input_event readBuffer[bufferSize];
     size_t capacity = bufferSize;
 
     mPendingEventIndex = 0;
-    int timeoutMillis = 0;
     int pollResult = epoll_wait(mEpollFd, mPendingEventItems, EPOLL_MAX_EVENTS, timeoutMillis);
 
-    // mLock.lock(); // reacquire lock after poll, must be after acquire_wake_lock
+    AutoMutex _l(mLock); // devices are changed only in this thread, but start() scans them.
         if (pollResult == 0) {
             // Timed out.
             mPendingEventCount = 0;
@@ -880,6 +1446,20 @@ void EventHub::loopOnce()
                 continue;
             }
 
+            if (eventItem.data.u32 == EPOLL_ID_WAKE) {
+                if (eventItem.events & EPOLLIN) {
+                    char buffer[16];
+                    ssize_t nRead;
+                    do {
+                        nRead = read(mWakeReadPipeFd, buffer, sizeof(buffer));
+                    } while ((nRead == -1 && errno == EINTR) || nRead == sizeof(buffer));
+                } else {
+                    ALOGW("Received unexpected epoll event 0x%08x for wake read pipe.",
+                            eventItem.events);
+                }
+                continue;
+            }
+
             ssize_t deviceIndex = mDevices.indexOfKey(eventItem.data.u32);
             if (deviceIndex < 0) {
                 ALOGW("Received unexpected epoll event 0x%08x for unknown device id %d.",
@@ -907,13 +1487,26 @@ void EventHub::loopOnce()
                 } else {
                     int32_t deviceId = device->id == mBuiltInKeyboardId ? 0 : device->id;
 
+                    const nsecs_t readTime = systemTime(SYSTEM_TIME_MONOTONIC);
                     size_t count = size_t(readSize) / sizeof(struct input_event);
                     for (size_t i = 0; i < count; i++) {
                         struct input_event& iev = readBuffer[i];
-                        ALOGD("%s got: time=%d.%06d, type=%d, code=%d, value=%d",
-                                device->path.string(),
-                                (int) iev.time.tv_sec, (int) iev.time.tv_usec,
-                                iev.type, iev.code, iev.value);
+                        if (mLogEvents) {
+                            ALOGD("%s got: time=%d.%06d, type=%d, code=%d, value=%d",
+                                    device->path.string(),
+                                    (int) iev.time.tv_sec, (int) iev.time.tv_usec,
+                                    iev.type, iev.code, iev.value);
+                        }
+                        RawInputEvent event;
+                        event.deviceSeq = ++ device->rawEventSeq;
+                        event.deviceId = deviceId;
+                        event.when = nsecs_t(iev.time.tv_sec) * 1000000000LL
+                                + nsecs_t(iev.time.tv_usec) * 1000LL;
+                        event.readTime = readTime;
+                        event.type = iev.type;
+                        event.code = iev.code;
+                        event.value = iev.value;
+                        mRawEvents.publish(event);
                     }
 
                 }
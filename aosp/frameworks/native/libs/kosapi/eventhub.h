@@ -38,6 +38,9 @@
 #include <sys/epoll.h>
 #include <kosapi/sys.h>
 
+#include <atomic>
+#include <thread>
+
 namespace android {
 
 enum {
@@ -105,14 +108,82 @@ enum {
  */
 extern uint32_t getAbsAxisUsage(int32_t axis, uint32_t deviceClasses);
 
+/*
+ * One raw evdev event read by EventHub.
+ */
+struct RawInputEvent {
+    uint64_t seq;       // increase by 1 every event of all devices, start from 1
+    uint32_t deviceSeq; // increase by 1 every event of this device, start from 1
+    int32_t deviceId;
+    nsecs_t when;       // kernel timestamp, CLOCK_MONOTONIC
+    nsecs_t readTime;   // EventHub read it
+    int32_t type;
+    int32_t code;
+    int32_t value;
+};
+
+/*
+ * Ring of the latest RawInputEvents. One producer(EventHub thread), any number of consumers,
+ * neither side takes a lock. A slow consumer never blocks producer, it loses overwritten events.
+ */
+class RawEventRing {
+public:
+    static const size_t kCapacity = 1024; // power of 2
+
+    RawEventRing();
+
+    // producer only, event.seq is assigned.
+    void publish(RawInputEvent& event);
+    // seq of the latest published event, 0 if none.
+    uint64_t lastSeq() const { return mLastSeq.load(std::memory_order_acquire); }
+
+    // copy event of seq, return false if it isn't published yet or has been overwritten.
+    bool read(uint64_t seq, RawInputEvent* outEvent) const;
+
+private:
+    struct Slot {
+        // seq of event in it, 0 while producer is writing it.
+        std::atomic<uint64_t> seq;
+        RawInputEvent event;
+    };
+    Slot mSlots[kCapacity];
+    std::atomic<uint64_t> mLastSeq;
+};
+
+/*
+ * A consumer of RawEventRing, it sees events published after it is created.
+ * Every subscriber has its own cursor, so diagnostics and latency measurement don't disturb each other.
+ */
+class RawEventSubscriber {
+public:
+    explicit RawEventSubscriber(const RawEventRing& ring);
+
+    // copy at most max events, oldest first. return count.
+    size_t read(RawInputEvent* outEvents, size_t max);
+    // events that were overwritten before this subscriber read them.
+    uint64_t lost() const { return mLost; }
+
+private:
+    const RawEventRing& mRing;
+    uint64_t mNextSeq;
+    uint64_t mLost;
+};
+
 class EventHub
 {
 public:
     EventHub();
     virtual ~EventHub();
 
+    // scan devices, then run loopOnce in a thread until stop.
     void start();
-    void loopOnce();
+    void stop();
+    // timeoutMillis: -1 blocks until an event arrives or wake is called.
+    void loopOnce(int timeoutMillis = -1);
+    // wake up blocked loopOnce.
+    void wake();
+
+    const RawEventRing& getRawEventRing() const { return mRawEvents; }
     // uint32_t send_input(uint32_t input_count, kosInput* inputs, int sizeof_input);
 
 private:
@@ -150,6 +221,10 @@ private:
         int32_t timestampOverrideSec;
         int32_t timestampOverrideUsec;
 
+        uint32_t rawEventSeq;
+
+        bool probeCached;
+
         Device(int fd, int32_t id, const String8& path, const InputDeviceIdentifier& identifier);
         ~Device();
 
@@ -165,7 +240,32 @@ private:
         }
     };
 
+    /*
+     * What openDeviceLocked found out about a device: bitmasks, classes and resolved key map files.
+     * It is persisted, so next start or hotplug of the same device skips the ioctls and key map search.
+     */
+    struct DeviceProbe {
+        uint32_t classes;
+
+        uint8_t keyBitmask[(KEY_MAX + 1) / 8];
+        uint8_t absBitmask[(ABS_MAX + 1) / 8];
+        uint8_t relBitmask[(REL_MAX + 1) / 8];
+        uint8_t swBitmask[(SW_MAX + 1) / 8];
+        uint8_t ledBitmask[(LED_MAX + 1) / 8];
+        uint8_t ffBitmask[(FF_MAX + 1) / 8];
+        uint8_t propBitmask[(INPUT_PROP_MAX + 1) / 8];
+
+        // empty if device hasn't it. mtime is -1 if file doesn't exist, probe is stale once it changes.
+        String8 keyLayoutFile;
+        nsecs_t keyLayoutMtime;
+        String8 keyCharacterMapFile;
+        nsecs_t keyCharacterMapMtime;
+        String8 virtualKeyMapFile;
+        nsecs_t virtualKeyMapMtime;
+    };
+
     status_t openDeviceLocked(const char *devicePath);
+    status_t probeDeviceLocked(Device* device);
     void addDeviceLocked(Device* device);
 
     void closeDeviceLocked(Device* device);
@@ -188,6 +288,15 @@ private:
     Device* getDeviceLocked(int32_t deviceId) const;
     Device* getDeviceByPathLocked(const char* devicePath) const;
 
+    bool applyProbeLocked(Device* device, const String8& probeKey, status_t* outKeyMapStatus);
+    void addProbeLocked(Device* device, const String8& probeKey);
+    void removeProbeLocked(size_t index);
+    void refreshProbesLocked();
+    void loadProbesLocked();
+    void saveProbesLocked();
+    status_t getKeyLayoutMapLocked(const String8& path, sp<KeyLayoutMap>* outMap);
+    status_t getKeyCharacterMapLocked(const String8& path, sp<KeyCharacterMap>* outMap);
+
 private:
     // Protect all internal state.
     mutable Mutex mLock;
@@ -207,8 +316,29 @@ private:
 
     KeyedVector<int32_t, Device*> mDevices;
 
+    // Device probes by getProbeKey, persisted to mProbeCachePath if it isn't empty.
+    KeyedVector<String8, DeviceProbe> mProbes;
+    String8 mProbeCachePath;
+    // mtime of key map directories, all probes are stale once one of them changes.
+    Vector<nsecs_t> mConfigurationDirMtimes;
+    bool mProbesLoaded;
+    bool mProbesDirty;
+
+    // Parsed key maps by path, shared by devices that use the same file.
+    KeyedVector<String8, sp<KeyLayoutMap> > mKeyLayoutMaps;
+    KeyedVector<String8, sp<KeyCharacterMap> > mKeyCharacterMaps;
+
     int mEpollFd;
     int mINotifyFd;
+    int mWakeReadPipeFd;
+    int mWakeWritePipeFd;
+
+    std::thread mThread;
+    std::atomic<bool> mExitPending;
+
+    RawEventRing mRawEvents;
+    // log every raw event, property kos.eventhub.log is 1.
+    bool mLogEvents;
 
     // Ids used for epoll notifications not associated with devices.
     static const uint32_t EPOLL_ID_INOTIFY = 0x80000001;
@@ -0,0 +1,124 @@
+#define LOG_TAG "ScreenRecord"
+//#define LOG_NDEBUG 0
+#include <utils/Log.h>
+
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include "SyntheticSource.h"
+
+using namespace android;
+
+enum {
+    NAL_SLICE = 1,
+    NAL_IDR = 5,
+    NAL_SEI = 6,
+    NAL_SPS = 7,
+    NAL_PPS = 8,
+    NAL_AUD = 9,
+};
+
+static const uint8_t kStartCode[] = {0, 0, 0, 1};
+
+// Return offset of next start code at or after pos, and its length by *codeLen.
+static size_t findStartCode(const uint8_t* data, size_t size, size_t pos, size_t* codeLen) {
+    for (; pos + 3 <= size; pos++) {
+        if (data[pos] == 0 && data[pos + 1] == 0) {
+            if (data[pos + 2] == 1) {
+                *codeLen = 3;
+                return pos;
+            }
+            if (pos + 4 <= size && data[pos + 2] == 0 && data[pos + 3] == 1) {
+                *codeLen = 4;
+                return pos;
+            }
+        }
+    }
+    *codeLen = 0;
+    return size;
+}
+
+status_t SyntheticSource::load(const char* path) {
+    mData.clear();
+    mConfig.clear();
+    mUnits.clear();
+
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        ALOGE("SyntheticSource: unable to open %s: %s", path, strerror(errno));
+        return NAME_NOT_FOUND;
+    }
+    std::vector<uint8_t> file;
+    uint8_t buf[64 * 1024];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        file.insert(file.end(), buf, buf + got);
+    }
+    fclose(fp);
+
+    mData.reserve(file.size());
+    AccessUnit current;
+    current.offset = 0;
+    bool hasConfig = false;
+    mCurrentHasPicture = false;
+
+    size_t codeLen;
+    size_t pos = findStartCode(file.data(), file.size(), 0, &codeLen);
+    while (pos < file.size()) {
+        const size_t nalStart = pos + codeLen;
+        size_t nextLen;
+        const size_t next = findStartCode(file.data(), file.size(), nalStart, &nextLen);
+        if (next > nalStart) {
+            appendNal(file.data() + nalStart, next - nalStart, &current, &hasConfig);
+        }
+        pos = next;
+        codeLen = nextLen;
+    }
+    if (current.size != 0) {
+        mUnits.push_back(current);
+    }
+
+    ALOGD("SyntheticSource: %s, %zu bytes, %zu access units", path, file.size(), mUnits.size());
+    return mUnits.empty() ? BAD_VALUE : NO_ERROR;
+}
+
+void SyntheticSource::appendNal(const uint8_t* nal, size_t size, AccessUnit* current, bool* hasConfig) {
+    const int type = nal[0] & 0x1f;
+    const bool vcl = type == NAL_SLICE || type == NAL_IDR;
+    // ue(v) of first_mb_in_slice is 0 when the first bit is 1.
+    const bool firstSlice = vcl && size > 1 && (nal[1] & 0x80) != 0;
+
+    // A new access unit starts at AUD/SEI/SPS/PPS or first slice, if current one already has picture.
+    if (mCurrentHasPicture && (!vcl || firstSlice)) {
+        mUnits.push_back(*current);
+        *current = AccessUnit();
+        current->offset = mData.size();
+        mCurrentHasPicture = false;
+        *hasConfig = false;
+    }
+    if (vcl) {
+        mCurrentHasPicture = true;
+    }
+
+    if (type == NAL_SPS) {
+        mConfig.clear();
+    }
+    if (type == NAL_SPS || type == NAL_PPS) {
+        mConfig.insert(mConfig.end(), kStartCode, kStartCode + sizeof(kStartCode));
+        mConfig.insert(mConfig.end(), nal, nal + size);
+        *hasConfig = true;
+    }
+    if (type == NAL_IDR && !current->keyFrame) {
+        current->keyFrame = true;
+        if (!*hasConfig && !mConfig.empty()) {
+            mData.insert(mData.end(), mConfig.begin(), mConfig.end());
+            current->size += mConfig.size();
+            *hasConfig = true;
+        }
+    }
+
+    mData.insert(mData.end(), kStartCode, kStartCode + sizeof(kStartCode));
+    mData.insert(mData.end(), nal, nal + size);
+    current->size += sizeof(kStartCode) + size;
+}
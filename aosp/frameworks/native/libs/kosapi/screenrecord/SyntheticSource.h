@@ -0,0 +1,49 @@
+#ifndef SCREENRECORD_SYNTHETIC_SOURCE_H
+#define SCREENRECORD_SYNTHETIC_SOURCE_H
+
+#include <utils/Errors.h>
+#include <vector>
+
+namespace android {
+
+/*
+ * Replay a recorded H.264 elementary stream(Annex-B) instead of capturing
+ * the screen, so that server throughput and latency can be measured
+ * without SurfaceFlinger and the hardware encoder.
+ *
+ * Select it by system property:
+ *   kos.screenrecord.synthetic      path of .h264 file
+ *   kos.screenrecord.synthetic_fps  frames per second, default is max_fps_to_encoder
+ * The stream must be recorded at the current display size.
+ */
+class SyntheticSource {
+public:
+    struct AccessUnit {
+        AccessUnit() : offset(0), size(0), keyFrame(false) {}
+        size_t offset;
+        size_t size;
+        bool keyFrame;
+    };
+
+    SyntheticSource() : mCurrentHasPicture(false) {}
+
+    // Read file and split it into access units. IDR access unit without
+    // SPS/PPS is prefixed with the latest ones, same as encoder's SYNCFRAME.
+    status_t load(const char* path);
+
+    size_t count() const { return mUnits.size(); }
+    const AccessUnit& unit(size_t index) const { return mUnits[index]; }
+    const uint8_t* data(const AccessUnit& unit) const { return mData.data() + unit.offset; }
+
+private:
+    void appendNal(const uint8_t* nal, size_t size, AccessUnit* current, bool* hasConfig);
+
+    std::vector<uint8_t> mData;     // access units, one by one
+    std::vector<uint8_t> mConfig;   // latest SPS and PPS, with start code
+    std::vector<AccessUnit> mUnits;
+    bool mCurrentHasPicture;        // used when loading
+};
+
+}; // namespace android
+
+#endif /*SCREENRECORD_SYNTHETIC_SOURCE_H*/
@@ -0,0 +1,123 @@
+// Host test and load benchmark of SyntheticSource, it isn't in Android.mk.
+// Build on linux against system/core/include and host liblog:
+//   g++ -std=c++14 -O2 -I<aosp>/system/core/include SyntheticSource.cpp SyntheticSource_test.cpp -llog
+// Run: ./a.out [frames]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "SyntheticSource.h"
+
+using namespace android;
+
+static int failures = 0;
+
+#define EXPECT(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+static int64_t nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void writeFile(const char* path, const std::vector<uint8_t>& data) {
+    FILE* fp = fopen(path, "wb");
+    fwrite(data.data(), 1, data.size(), fp);
+    fclose(fp);
+}
+
+static void append(std::vector<uint8_t>* out, const uint8_t* data, size_t size) {
+    out->insert(out->end(), data, data + size);
+}
+
+// SPS PPS IDR | P | P(two slices) | IDR without SPS/PPS
+static void testSplit(const char* path) {
+    static const uint8_t sps[] = {0, 0, 0, 1, 0x67, 1, 2};
+    static const uint8_t pps[] = {0, 0, 1, 0x68, 3};
+    static const uint8_t idr[] = {0, 0, 0, 1, 0x65, 0x88, 9, 9};
+    static const uint8_t p1[] = {0, 0, 1, 0x41, 0x9a, 5};
+    static const uint8_t p2a[] = {0, 0, 1, 0x41, 0x9a, 6};
+    static const uint8_t p2b[] = {0, 0, 1, 0x41, 0x1a, 7};
+
+    std::vector<uint8_t> stream;
+    append(&stream, sps, sizeof(sps));
+    append(&stream, pps, sizeof(pps));
+    append(&stream, idr, sizeof(idr));
+    append(&stream, p1, sizeof(p1));
+    append(&stream, p2a, sizeof(p2a));
+    append(&stream, p2b, sizeof(p2b));
+    append(&stream, idr, sizeof(idr));
+    writeFile(path, stream);
+
+    SyntheticSource source;
+    EXPECT(source.load(path) == NO_ERROR);
+    EXPECT(source.count() == 4);
+    if (source.count() != 4) {
+        return;
+    }
+    // every nal is rewritten with 4-byte start code.
+    EXPECT(source.unit(0).keyFrame && source.unit(0).size == 7 + 6 + 8);
+    EXPECT(!source.unit(1).keyFrame && source.unit(1).size == 7);
+    EXPECT(!source.unit(2).keyFrame && source.unit(2).size == 7 + 7);
+    // the last IDR is prefixed with SPS and PPS.
+    EXPECT(source.unit(3).keyFrame && source.unit(3).size == 7 + 6 + 8);
+    const uint8_t* last = source.data(source.unit(3));
+    EXPECT(memcmp(last, sps, sizeof(sps)) == 0);
+    EXPECT(last[4 + 3] == 0 && last[4 + 3 + 3] == 1 && last[4 + 3 + 4] == 0x68);
+
+    EXPECT(source.load("/nonexistent/synthetic.h264") == NAME_NOT_FOUND);
+}
+
+// gop of 30, IDR is 60 KB and P is 8 KB, about a 1080p screen stream.
+static void benchLoad(const char* path, int frames) {
+    static const uint8_t sps[] = {0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x28};
+    static const uint8_t pps[] = {0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80};
+
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> payload;
+    for (int at = 0; at < frames; at++) {
+        const bool key = at % 30 == 0;
+        if (key) {
+            append(&stream, sps, sizeof(sps));
+            append(&stream, pps, sizeof(pps));
+        }
+        payload.assign(key ? 60 * 1024 : 8 * 1024, 0x5a);
+        payload[0] = key ? 0x65 : 0x41;
+        payload[1] = 0x88;
+        const uint8_t code[] = {0, 0, 0, 1};
+        append(&stream, code, sizeof(code));
+        append(&stream, payload.data(), payload.size());
+    }
+    writeFile(path, stream);
+
+    SyntheticSource source;
+    const int64_t start = nowUs();
+    const status_t err = source.load(path);
+    const int64_t used = nowUs() - start;
+    EXPECT(err == NO_ERROR);
+    EXPECT((int)source.count() == frames);
+    printf("load: %zu bytes, %zu access units, %lld us, %.1f MB/s\n", stream.size(), source.count(),
+            (long long)used, used > 0 ? stream.size() / (double)used : 0.0);
+}
+
+int main(int argc, char** argv) {
+    const int frames = argc > 1 ? atoi(argv[1]) : 3000;
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/synthetic-%d.h264", (int)getpid());
+
+    testSplit(path);
+    benchLoad(path, frames);
+    unlink(path);
+
+    printf("%s\n", failures == 0 ? "PASS" : "FAIL");
+    return failures == 0 ? 0 : 1;
+}
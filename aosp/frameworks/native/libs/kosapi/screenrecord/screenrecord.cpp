@@ -29,6 +29,8 @@
 
 #include <termios.h>
 #include <unistd.h>
+#include <time.h>
+#include <vector>
 
 #define LOG_TAG "ScreenRecord"
 #define ATRACE_TAG ATRACE_TAG_GRAPHICS
@@ -36,9 +38,11 @@
 #include <utils/Log.h>
 
 #include <binder/IPCThreadState.h>
+#include <cutils/properties.h>
 #include <utils/Errors.h>
 #include <utils/Timers.h>
 #include <utils/Trace.h>
+#include <utils/Mutex.h>
 
 #include <gui/Surface.h>
 #include <gui/SurfaceComposerClient.h>
@@ -55,7 +59,8 @@
 #include "screenrecord.h"
 // #include "Overlay.h"
 #include "FrameOutput.h"
-// #include "eventhub.h"
+#include "SyntheticSource.h"
+#include "eventhub.h"
 #include "sendinput.h"
 #include <kosapi/sys.h>
 // #include <kosapi/net.h>
@@ -82,6 +87,56 @@ static uint32_t gBitRate = 4000000;     // 4Mbps
 static uint32_t gTimeLimitSec = kMaxTimeLimitSec;
 static bool gPause = false;
 static bool gRequireSetPause = false;
+
+// Written by encoder thread, read by kosGetFrameTraces.
+static const int kFrameTraceCount = 64;
+static KosFrameTrace gFrameTraces[kFrameTraceCount];
+static uint32_t gFrameTraceSeq = 0;
+static Mutex gFrameTraceLock;
+
+// The oldest kosSendInput batch that no frame has been composed after. Virtual display produces
+// a frame only when screen changes, so next frame is the first changed frame after injection.
+// If input changes nothing, a later unrelated frame isn't its result, give up after timeout.
+static const int64_t kInputFrameTimeoutUsec = 1000000;
+static uint32_t gPendingInputSeq = 0;
+static int64_t gPendingInputUsec = 0;
+
+static void didInjectInput(uint32_t seq, int64_t usec) {
+    Mutex::Autolock _l(gFrameTraceLock);
+    if (gPendingInputSeq == 0) {
+        gPendingInputSeq = seq;
+        gPendingInputUsec = usec;
+    }
+}
+
+static uint32_t beginFrameTrace(uint32_t size, int64_t ptsUsec, int64_t outputUsec) {
+    Mutex::Autolock _l(gFrameTraceLock);
+    const uint32_t seq = ++ gFrameTraceSeq;
+    KosFrameTrace& trace = gFrameTraces[seq % kFrameTraceCount];
+    trace.seq = seq;
+    trace.size = size;
+    trace.pts_usec = ptsUsec;
+    trace.output_usec = outputUsec;
+    trace.delivered_usec = 0;
+    trace.input_seq = 0;
+    trace.input_usec = 0;
+    if (gPendingInputSeq != 0 && ptsUsec >= gPendingInputUsec) {
+        if (ptsUsec - gPendingInputUsec < kInputFrameTimeoutUsec) {
+            trace.input_seq = gPendingInputSeq;
+            trace.input_usec = gPendingInputUsec;
+        }
+        gPendingInputSeq = 0;
+    }
+    return seq;
+}
+
+static void endFrameTrace(uint32_t seq) {
+    Mutex::Autolock _l(gFrameTraceLock);
+    KosFrameTrace& trace = gFrameTraces[seq % kFrameTraceCount];
+    if (trace.seq == seq) {
+        trace.delivered_usec = systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
+    }
+}
 // EventHub* gEventHubPtr = nullptr;
 // NativeConnection* gConnectionPtr = nullptr;
 
@@ -373,6 +428,7 @@ static status_t runEncoder(const sp<MediaCodec>& encoder,
         ALOGV("#%u Calling dequeueOutputBuffer", callDequeueOutputBufferTimes);
         err = encoder->dequeueOutputBuffer(&bufIndex, &offset, &size, &ptsUsec,
                 &flags, kTimeout);
+        const int64_t outputUsec = systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
         ALOGV("#%u dequeueOutputBuffer returned %d", callDequeueOutputBufferTimes, err);
         callDequeueOutputBufferTimes ++;
         switch (err) {
@@ -442,7 +498,10 @@ static status_t runEncoder(const sp<MediaCodec>& encoder,
                     }
 */
                     flags2 |= mainDpyInfo.orientation;
+                    // record trace before didScreenCaptured, receiver may consume this frame before it returns.
+                    const uint32_t traceSeq = beginFrameTrace(size, ptsUsec, outputUsec);
                     didScreenCaptured(pixelBuf, size, gVideoWidth, gVideoHeight, flags2, user);
+                    endFrameTrace(traceSeq);
                     // ALOGV("post didScreenCaptured");
 /*
                     // Flush the data immediately in case we're streaming.
@@ -540,6 +599,75 @@ void prepareInputDevice()
 
 }
 
+/*
+ * Deliver access units of a recorded H.264 stream at fps, instead of
+ * capturing screen. See SyntheticSource.h.
+ */
+static status_t runSynthetic(const char* path, float fps, uint8_t* pixelBuf,
+        fdid_gui2_screen_captured didScreenCaptured, void* user) {
+    SyntheticSource source;
+    status_t err = source.load(path);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    DisplayInfo mainDpyInfo;
+    sp<IBinder> mainDpy = SurfaceComposerClient::getBuiltInDisplay(
+            ISurfaceComposer::eDisplayIdMain);
+    err = SurfaceComposerClient::getDisplayInfo(mainDpy, &mainDpyInfo);
+    if (err != NO_ERROR) {
+        ALOGE("ERROR: unable to get display characteristics");
+        return err;
+    }
+    bool rotated = isDeviceRotated(mainDpyInfo.orientation);
+    gVideoWidth = rotated ? mainDpyInfo.h : mainDpyInfo.w;
+    gVideoHeight = rotated ? mainDpyInfo.w : mainDpyInfo.h;
+    // pixelBuf is sized for one RGBA frame, same as FORMAT_RAW_FRAMES.
+    const size_t maxBytes = gVideoWidth * gVideoHeight * 4;
+
+    ALOGD("runSynthetic: %s, %zu access units at %.1ffps, %ux%u",
+            path, source.count(), fps, gVideoWidth, gVideoHeight);
+
+    const int64_t intervalNsec = (int64_t)(1000000000LL / fps);
+    int64_t nextNsec = systemTime(SYSTEM_TIME_MONOTONIC);
+    bool requireKeyFrame = true;
+    for (size_t index = 0; !gStopRequested; index = (index + 1) % source.count()) {
+        const SyntheticSource::AccessUnit& unit = source.unit(index);
+
+        struct timespec ts;
+        ts.tv_sec = nextNsec / 1000000000LL;
+        ts.tv_nsec = nextNsec % 1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        const int64_t ptsUsec = nextNsec / 1000;
+        nextNsec += intervalNsec;
+
+        if (gPause) {
+            // same as "drop-input-frames", but references are lost, restart from key frame.
+            requireKeyFrame = true;
+            continue;
+        }
+        if (requireKeyFrame && !unit.keyFrame) {
+            continue;
+        }
+        requireKeyFrame = false;
+        if (unit.size > maxBytes) {
+            ALOGW("runSynthetic: access unit #%zu(%zu bytes) exceeds %zu, skip", index, unit.size, maxBytes);
+            requireKeyFrame = true;
+            continue;
+        }
+
+        uint32_t flags2 = mainDpyInfo.orientation;
+        if (unit.keyFrame) {
+            flags2 |= KOS_RECORDSCREEN_FLAG_SYNCFRAME;
+        }
+        memcpy(pixelBuf, source.data(unit), unit.size);
+        const uint32_t traceSeq = beginFrameTrace(unit.size, ptsUsec, systemTime(SYSTEM_TIME_MONOTONIC) / 1000);
+        didScreenCaptured(pixelBuf, unit.size, gVideoWidth, gVideoHeight, flags2, user);
+        endFrameTrace(traceSeq);
+    }
+    return NO_ERROR;
+}
+
 /*
  * Main "do work" start point.
  *
@@ -720,7 +848,18 @@ NDK_EXPORT int kosRecordScreenLoop(uint32_t bitrate_kbps, uint32_t max_fps_to_en
 
     ALOGD("gOutputFormat: %i, gBitRate: %u", gOutputFormat, gBitRate);
 
-    status_t err = recordScreen(max_fps_to_encoder, pixel_buf, did, user);
+    status_t err;
+    char synthetic[PROPERTY_VALUE_MAX];
+    if (bitrate_kbps > 0 && property_get("kos.screenrecord.synthetic", synthetic, NULL) > 0) {
+        char value[PROPERTY_VALUE_MAX];
+        float fps = max_fps_to_encoder != 0? max_fps_to_encoder: 30;
+        if (property_get("kos.screenrecord.synthetic_fps", value, NULL) > 0 && atof(value) > 0) {
+            fps = atof(value);
+        }
+        err = runSynthetic(synthetic, fps, pixel_buf, did, user);
+    } else {
+        err = recordScreen(max_fps_to_encoder, pixel_buf, did, user);
+    }
     gPause = false;
     gRequireSetPause = false;
     ALOGD("---screenrecord.cpp::kosRecordScreenLoop X err: %s", err == NO_ERROR ? "success" : "failed");
@@ -748,6 +887,24 @@ NDK_EXPORT bool kosRecordScreenPaused()
     return gPause;
 }
 
+NDK_EXPORT int kosGetFrameTraces(uint32_t after_seq, KosFrameTrace* traces, int max)
+{
+    if (traces == nullptr || max <= 0) {
+        return 0;
+    }
+    Mutex::Autolock _l(gFrameTraceLock);
+    uint32_t seq = after_seq + 1;
+    if (gFrameTraceSeq - after_seq > (uint32_t)kFrameTraceCount) {
+        // requested ones are overwritten, start from the oldest kept.
+        seq = gFrameTraceSeq - kFrameTraceCount + 1;
+    }
+    int count = 0;
+    for (; count < max && seq <= gFrameTraceSeq; seq ++, count ++) {
+        traces[count] = gFrameTraces[seq % kFrameTraceCount];
+    }
+    return count;
+}
+
 NDK_EXPORT void kosGetDisplayInfo(KosDisplayInfo* info)
 {
     memset(info, 0, sizeof(KosDisplayInfo));
@@ -771,41 +928,145 @@ NDK_EXPORT void kosGetDisplayInfo(KosDisplayInfo* info)
     info->secure = mainDpyInfo.secure;
 }
 
-static NativeConnection* gConnectionPtr = nullptr;
+// reads raw events of all input devices, started by first subscriber, lives until process exits.
+static Mutex gEventHubLock;
+static EventHub* gEventHub = nullptr;
+
+static EventHub* startEventHub()
+{
+    Mutex::Autolock _l(gEventHubLock);
+    if (gEventHub == nullptr) {
+        gEventHub = new EventHub;
+        gEventHub->start();
+    }
+    return gEventHub;
+}
+
+struct KosRawEventSubscriber {
+    explicit KosRawEventSubscriber(const RawEventRing& ring) :
+        subscriber(ring) {}
+
+    RawEventSubscriber subscriber;
+    std::vector<RawInputEvent> buffer;
+};
+
+NDK_EXPORT KosRawEventSubscriber* kosSubscribeRawEvents()
+{
+    return new KosRawEventSubscriber(startEventHub()->getRawEventRing());
+}
+
+NDK_EXPORT int kosReadRawEvents(KosRawEventSubscriber* subscriber, KosRawEvent* events, int max, uint64_t* lost)
+{
+    if (subscriber == nullptr || events == nullptr || max <= 0) {
+        return 0;
+    }
+    subscriber->buffer.resize(max);
+    const int count = subscriber->subscriber.read(subscriber->buffer.data(), max);
+    for (int n = 0; n < count; n ++) {
+        const RawInputEvent& src = subscriber->buffer[n];
+        KosRawEvent& dst = events[n];
+        dst.seq = src.seq;
+        dst.device_seq = src.deviceSeq;
+        dst.device_id = src.deviceId;
+        dst.when_ns = src.when;
+        dst.read_time_ns = src.readTime;
+        dst.type = src.type;
+        dst.code = src.code;
+        dst.value = src.value;
+    }
+    if (lost != nullptr) {
+        *lost = subscriber->subscriber.lost();
+    }
+    return count;
+}
+
+NDK_EXPORT void kosUnsubscribeRawEvents(KosRawEventSubscriber* subscriber)
+{
+    delete subscriber;
+}
+
+NDK_EXPORT int kosAcquireInputDevice(int kind, int screen_width, int screen_height)
+{
+    return InputDeviceRegistry::instance().acquire(kind, screen_width, screen_height) != nullptr? kind: 0;
+}
+
+NDK_EXPORT void kosReleaseInputDevice(int handle)
+{
+    InputDeviceRegistry::instance().release(handle);
+}
 
 NDK_EXPORT bool kosCreateInput(bool keyboard, int screen_width, int screen_height)
 {
-    if (gConnectionPtr != nullptr) {
-        ALOGD("kosCreateInput fail, at most one input device anytime");
-        return false;
+    InputDeviceRegistry& registry = InputDeviceRegistry::instance();
+    if (keyboard) {
+        registry.acquire(KOS_INPUT_DEVICE_KEYBOARD, screen_width, screen_height);
     }
-    gConnectionPtr = NativeConnection::open("RDP uinput", "com.kos.launcher", keyboard, screen_width, screen_height);
-    return gConnectionPtr != nullptr;
+    registry.deferTouch(screen_width, screen_height);
+    return registry.acquire(KOS_INPUT_DEVICE_MOUSE, screen_width, screen_height) != nullptr;
 }
 
 NDK_EXPORT void kosDestroyInput()
 {
-    if (gConnectionPtr == nullptr) {
-        return;
-    }
-    delete gConnectionPtr;
-    gConnectionPtr = nullptr;
+    InputDeviceRegistry& registry = InputDeviceRegistry::instance();
+    registry.release(KOS_INPUT_DEVICE_KEYBOARD);
+    registry.release(KOS_INPUT_DEVICE_MOUSE);
+    registry.release(KOS_INPUT_DEVICE_TOUCH);
+    registry.release(KOS_INPUT_DEVICE_RELATIVE_MOUSE);
+}
+
+NDK_EXPORT bool kosSetMouseMode(int mode, int scale_permille)
+{
+    return InputDeviceRegistry::instance().setMouseMode(mode, scale_permille);
 }
 
+// id of kosSendInput batch, increase by 1 every batch, start from 1. all are called in one thread.
+static uint32_t gInputSeq = 0;
+
+static void injectInput(uint32_t input_count, KosInput* inputs)
+{
+    const uint32_t seq = ++ gInputSeq;
+    const int64_t usec = systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
+    InputDeviceRegistry::instance().inject(input_count, inputs, usec);
+    didInjectInput(seq, usec);
+}
+
+// inputs queued between kosBeginInputBatch and kosEndInputBatch. all are called in one thread.
+static int gInputBatchDepth = 0;
+static std::vector<KosInput> gInputBatch;
+
 NDK_EXPORT uint32_t kosSendInput(uint32_t input_count, KosInput* inputs)
 {
-    if (gConnectionPtr == nullptr) {
-        return 0;
-    }
     if (input_count == 0 || inputs == nullptr) {
         return 0;
     }
-    return gConnectionPtr->send_input(input_count, inputs);
+    if (gInputBatchDepth > 0) {
+        gInputBatch.insert(gInputBatch.end(), inputs, inputs + input_count);
+        return input_count;
+    }
+    injectInput(input_count, inputs);
+    return input_count;
+}
+
+NDK_EXPORT void kosBeginInputBatch()
+{
+    gInputBatchDepth ++;
+}
+
+NDK_EXPORT void kosEndInputBatch()
+{
+    if (gInputBatchDepth == 0 || -- gInputBatchDepth > 0) {
+        return;
+    }
+    if (!gInputBatch.empty()) {
+        injectInput(gInputBatch.size(), gInputBatch.data());
+    }
+    gInputBatch.clear();
 }
 
+// bump it, and min_libkosapi_ver in launcher, whenever an export or layout of an exported struct changes.
 NDK_EXPORT void kosGetVersion(char* ver, int /*max_bytes*/)
 {
-    strcpy(ver, "1.0.3-20210422");
+    strcpy(ver, "1.0.6-20261019");
     // char msg[64];
     // kosNetGetCfg(msg, sizeof(msg));
 }
\ No newline at end of file
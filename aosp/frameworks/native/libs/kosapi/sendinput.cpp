@@ -36,9 +36,10 @@
 #include <sys/time.h>
 #include <time.h>
 #include <stdint.h>
-#include <map>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <linux/uinput.h>
+#include <cutils/properties.h>
 #include <signal.h>
 #include <sys/inotify.h>
 #include <sys/stat.h>
@@ -48,6 +49,13 @@
 #define MSC_ANDROID_TIME_SEC 0x6
 #define MSC_ANDROID_TIME_USEC 0x7
 
+// kernel 5.0, 120 is one notch.
+#ifndef REL_WHEEL_HI_RES
+#define REL_WHEEL_HI_RES 0x0b
+#define REL_HWHEEL_HI_RES 0x0c
+#endif
+#define WHEEL_DELTA 120
+
 #define SLOT_UNKNOWN -1
 
 /**
@@ -428,7 +436,7 @@ typedef enum
                                  for array bounds */
 } SDL_Scancode;
 
-static const SDL_Scancode windows_scancode_table[] =
+static constexpr SDL_Scancode windows_scancode_table[] =
 {
 	/*	0						1							2							3							4						5							6							7 */
 	/*	8						9							A							B							C						D							E							F */
@@ -457,7 +465,7 @@ static const SDL_Scancode windows_scancode_table[] =
 	SDL_SCANCODE_UNKNOWN,		SDL_SCANCODE_INTERNATIONAL4,		SDL_SCANCODE_UNKNOWN,		SDL_SCANCODE_INTERNATIONAL5,		SDL_SCANCODE_UNKNOWN,	SDL_SCANCODE_INTERNATIONAL3,		SDL_SCANCODE_UNKNOWN,		SDL_SCANCODE_UNKNOWN	/* 7 */
 };
 
-static SDL_Scancode Android_Keycodes[] = {
+static constexpr SDL_Scancode Android_Keycodes[] = {
     SDL_SCANCODE_UNKNOWN, /* AKEYCODE_UNKNOWN */
     SDL_SCANCODE_UNKNOWN, /* AKEYCODE_SOFT_LEFT */
     SDL_SCANCODE_UNKNOWN, /* AKEYCODE_SOFT_RIGHT */
@@ -740,54 +748,198 @@ static SDL_Scancode Android_Keycodes[] = {
     SDL_SCANCODE_PASTE, /* AKEYCODE_PASTE */
 };
 
-int win_scan_code_2_android_scan_code(int win_code)
-{
-    // ALOGI("win_scan_code_2_android_scan_code--- win_code: %i", win_code);
-    SDL_Scancode usb_code = SDL_SCANCODE_UNKNOWN;
-    if (win_code >= 0 || win_code <= 127) {
-        usb_code = windows_scancode_table[win_code];
+// keys with 0xE0 prefix(KEYEVENTF_EXTENDEDKEY). extended code that isn't here is same as windows_scancode_table.
+static constexpr struct {
+    int win_code;
+    SDL_Scancode usb_code;
+} windows_extended_scancodes[] = {
+    { 0x1c, SDL_SCANCODE_KP_ENTER },
+    { 0x1d, SDL_SCANCODE_RCTRL },
+    { 0x35, SDL_SCANCODE_KP_DIVIDE },
+    { 0x37, SDL_SCANCODE_PRINTSCREEN },
+    { 0x38, SDL_SCANCODE_RALT },
+    { 0x47, SDL_SCANCODE_HOME },
+    { 0x48, SDL_SCANCODE_UP },
+    { 0x49, SDL_SCANCODE_PAGEUP },
+    { 0x4b, SDL_SCANCODE_LEFT },
+    { 0x4d, SDL_SCANCODE_RIGHT },
+    { 0x4f, SDL_SCANCODE_END },
+    { 0x50, SDL_SCANCODE_DOWN },
+    { 0x51, SDL_SCANCODE_PAGEDOWN },
+    { 0x52, SDL_SCANCODE_INSERT },
+    { 0x53, SDL_SCANCODE_DELETE },
+    { 0x5b, SDL_SCANCODE_LGUI },
+    { 0x5c, SDL_SCANCODE_RGUI },
+    { 0x5d, SDL_SCANCODE_APPLICATION },
+};
+
+#define WIN_SCANCODE_COUNT   128
+#define ANDROID_KEYCODE_COUNT    ((int)(sizeof(Android_Keycodes) / sizeof(Android_Keycodes[0])))
+
+// Direct-index tables, generated at compile time from windows_scancode_table, Android_Keycodes and KEYS.
+// Every translation is one array index. They are read-only data, nothing is built at runtime, so thread-safe.
+struct KeyTables {
+    // index: win_code, or WIN_SCANCODE_COUNT + win_code if extended. -1 if no android keycode.
+    int16_t winToAndroid[WIN_SCANCODE_COUNT * 2];
+    // index: android keycode. KEY_RESERVED(0) if linux keycode isn't in KEYS.
+    int16_t androidToLinux[ANDROID_KEYCODE_COUNT];
+
+    constexpr KeyTables() : winToAndroid(), androidToLinux() {
+        // usb ==> android, reverse of Android_Keycodes, first one wins if usb code appears more than once.
+        int16_t usbToAndroid[SDL_NUM_SCANCODES] = {};
+        for (int n = 0; n < SDL_NUM_SCANCODES; n ++) {
+            usbToAndroid[n] = -1;
+        }
+        for (int n = ANDROID_KEYCODE_COUNT - 1; n >= 0; n --) {
+            if (Android_Keycodes[n] != SDL_SCANCODE_UNKNOWN) {
+                usbToAndroid[Android_Keycodes[n]] = n;
+            }
+        }
+
+        for (int n = 0; n < WIN_SCANCODE_COUNT; n ++) {
+            const int16_t android = usbToAndroid[windows_scancode_table[n]];
+            winToAndroid[n] = android;
+            winToAndroid[WIN_SCANCODE_COUNT + n] = android;
+        }
+        for (const auto& extended : windows_extended_scancodes) {
+            winToAndroid[WIN_SCANCODE_COUNT + extended.win_code] = usbToAndroid[extended.usb_code];
+        }
+
+        // last one wins if android keycode appears more than once.
+        for (const auto& key : android::KEYS) {
+            androidToLinux[key.androidKeyCode] = key.linuxKeyCode;
+        }
     }
+};
+
+static constexpr KeyTables gKeyTables;
+
+static_assert(sizeof(windows_scancode_table) / sizeof(windows_scancode_table[0]) == WIN_SCANCODE_COUNT, "windows_scancode_table must have 128 entries");
+static_assert(ANDROID_KEYCODE_COUNT == AKEYCODE_PASTE + 1, "Android_Keycodes must be indexed by android keycode");
+static_assert(gKeyTables.winToAndroid[0x00] == -1, "0x00 has no key");
+static_assert(gKeyTables.winToAndroid[0x01] == AKEYCODE_ESCAPE, "0x01 ==> ESCAPE");
+static_assert(gKeyTables.winToAndroid[0x1e] == AKEYCODE_A, "0x1e ==> A");
+static_assert(gKeyTables.winToAndroid[0x1c] == AKEYCODE_ENTER, "0x1c ==> ENTER");
+static_assert(gKeyTables.winToAndroid[WIN_SCANCODE_COUNT + 0x1c] == AKEYCODE_NUMPAD_ENTER, "0xe0 0x1c ==> NUMPAD_ENTER");
+static_assert(gKeyTables.winToAndroid[0x1d] == AKEYCODE_CTRL_LEFT, "0x1d ==> CTRL_LEFT");
+static_assert(gKeyTables.winToAndroid[WIN_SCANCODE_COUNT + 0x1d] == AKEYCODE_CTRL_RIGHT, "0xe0 0x1d ==> CTRL_RIGHT");
+static_assert(gKeyTables.winToAndroid[WIN_SCANCODE_COUNT + 0x38] == AKEYCODE_ALT_RIGHT, "0xe0 0x38 ==> ALT_RIGHT");
+static_assert(gKeyTables.winToAndroid[WIN_SCANCODE_COUNT + 0x48] == AKEYCODE_DPAD_UP, "0xe0 0x48 ==> DPAD_UP");
+static_assert(gKeyTables.winToAndroid[WIN_SCANCODE_COUNT + 0x1e] == AKEYCODE_A, "not extended key, same as base table");
+static_assert(gKeyTables.androidToLinux[AKEYCODE_A] == KEY_A, "A ==> KEY_A");
+static_assert(gKeyTables.androidToLinux[AKEYCODE_CTRL_RIGHT] == KEY_RIGHTCTRL, "CTRL_RIGHT ==> KEY_RIGHTCTRL");
+static_assert(gKeyTables.androidToLinux[AKEYCODE_FORWARD_DEL] == KEY_DELETE, "FORWARD_DEL ==> KEY_DELETE");
+// KEYS maps KEY_HOME to AKEYCODE_MOVE_HOME: Home of a pc keyboard moves caret to line start.
+// AKEYCODE_HOME is android's home button, no linux keycode is mapped to it, so RDP Home never leaves the app.
+static_assert(gKeyTables.androidToLinux[AKEYCODE_HOME] == KEY_RESERVED, "HOME isn't in KEYS");
+
+// Reference lookups by linear scan of the source arrays, as the code before gKeyTables did.
+// Only evaluated at compile time, to check every entry of gKeyTables.
+static constexpr int16_t linearUsbToAndroid(SDL_Scancode usb_code) {
     if (usb_code == SDL_SCANCODE_UNKNOWN) {
-        ALOGI("---win_scan_code_2_android_scan_code, usb_code == SDL_SCANCODE_UNKNOWN, return -1");
         return -1;
     }
-    int size = sizeof(Android_Keycodes) / sizeof(Android_Keycodes[0]);
-    // ALOGI("win_scan_code_2_android_scan_code, size: %i, usb_code: %i", size, (int)usb_code);
-    for (int n = 0; n < size; n ++) {
+    for (int n = 0; n < ANDROID_KEYCODE_COUNT; n ++) {
         if (Android_Keycodes[n] == usb_code) {
-            // ALOGI("---win_scan_code_2_android_scan_code, %i ==> %i", usb_code, n);
             return n;
         }
     }
-    // ALOGI("---win_scan_code_2_android_scan_code, cannnot find, return -1");
     return -1;
 }
 
-namespace android {
+static constexpr int16_t linearWinToAndroid(int win_code, bool extended) {
+    if (extended) {
+        for (const auto& extended_code : windows_extended_scancodes) {
+            if (extended_code.win_code == win_code) {
+                return linearUsbToAndroid(extended_code.usb_code);
+            }
+        }
+    }
+    return linearUsbToAndroid(windows_scancode_table[win_code]);
+}
 
-static std::map<int32_t,int> keysMap;
+static constexpr int16_t linearAndroidToLinux(int androidKeyCode) {
+    for (int n = (int)(sizeof(android::KEYS) / sizeof(android::KEYS[0])) - 1; n >= 0; n --) {
+        if (android::KEYS[n].androidKeyCode == androidKeyCode) {
+            return android::KEYS[n].linuxKeyCode;
+        }
+    }
+    return KEY_RESERVED;
+}
 
-static void initKeysMap() {
-    if (keysMap.empty()) {
-        for (size_t i = 0; i < NELEM(KEYS); i++) {
-            keysMap[KEYS[i].androidKeyCode] = KEYS[i].linuxKeyCode;
+static constexpr bool verifyKeyTables() {
+    for (int n = 0; n < WIN_SCANCODE_COUNT; n ++) {
+        if (gKeyTables.winToAndroid[n] != linearWinToAndroid(n, false)
+                || gKeyTables.winToAndroid[WIN_SCANCODE_COUNT + n] != linearWinToAndroid(n, true)) {
+            return false;
+        }
+    }
+    for (int n = 0; n < ANDROID_KEYCODE_COUNT; n ++) {
+        if (gKeyTables.androidToLinux[n] != linearAndroidToLinux(n)) {
+            return false;
         }
     }
+    return true;
 }
 
+static_assert(verifyKeyTables(), "gKeyTables must match linear lookup of all 2 x 128 scan codes and every android keycode");
+
+int win_scan_code_2_android_scan_code(int win_code, bool extended)
+{
+    if (win_code < 0 || win_code >= WIN_SCANCODE_COUNT) {
+        return -1;
+    }
+    return gKeyTables.winToAndroid[extended? WIN_SCANCODE_COUNT + win_code: win_code];
+}
+
+namespace android {
+
 static int32_t getLinuxKeyCode(int32_t androidKeyCode) {
-    std::map<int,int>::iterator it = keysMap.find(androidKeyCode);
-    if (it != keysMap.end()) {
-        return it->second;
+    if (androidKeyCode < 0 || androidKeyCode >= ANDROID_KEYCODE_COUNT || gKeyTables.androidToLinux[androidKeyCode] == KEY_RESERVED) {
+        return KEY_UNKNOWN;
     }
-    return KEY_UNKNOWN;
+    return gKeyTables.androidToLinux[androidKeyCode];
 }
 
-NativeConnection::NativeConnection(int fd, int32_t maxPointers) :
+// register the input device. on fail, fd is closed.
+static bool registerDevice(int fd, const struct uinput_user_dev& uinp) {
+    if (write(fd, &uinp, sizeof(uinp)) != sizeof(uinp)) {
+        ALOGE("Cannot write uinput_user_dev to fd %d: %s.", fd, strerror(errno));
+        close(fd);
+        return false;
+    }
+    if (ioctl(fd, UI_DEV_CREATE) != 0) {
+        ALOGE("Unable to create uinput device: %s.", strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    ALOGD("Created uinput device, fd=%d.", fd);
+    return true;
+}
+
+NativeConnection::NativeConnection(int fd, int32_t maxPointers, bool multiTouch) :
     mFd(fd)
     , mMaxPointers(maxPointers)
     , lastX(0)
-    , lastY(0) {
+    , lastY(0)
+    , mMultiTouch(multiTouch)
+    , mCurrentSlot(-1)
+    , mNextTrackingId(0)
+    , mActiveSlots(0)
+    , mTouching(false)
+    , mRelativeScale(1000)
+    , mRelRemainderX(0)
+    , mRelRemainderY(0)
+    , mWheelRemainder(0)
+    , mHWheelRemainder(0)
+    , mRelHasLast(false)
+    , mRelLastX(0)
+    , mRelLastY(0)
+    , mTimestampUsec(0)
+    , mFrameStarted(false)
+    , mFrameCodeCount(0)
+    , mEventCount(0) {
     ALOGI("NativeConnection::NativeConnectione--- fd: %d maxPointers: %i", mFd, maxPointers);
     // nativeSendPointerMove(-1, -1);
     // sendEvent(EV_SYN, SYN_REPORT, 0);
@@ -821,9 +973,6 @@ NativeConnection* NativeConnection::open(const char* name, const char* uniqueId,
     uinp.absmin[ABS_Y] = 0;
     uinp.absmax[ABS_Y] = screenHeight - 1;
 
-    // initialize keymap
-    initKeysMap();
-
     // write device unique id to the phys property
     ioctl(fd, UI_SET_PHYS, uniqueId);
 
@@ -862,44 +1011,210 @@ NativeConnection* NativeConnection::open(const char* name, const char* uniqueId,
         ioctl(fd, UI_SET_EVBIT, EV_REL);
         ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
         ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+        ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+        ioctl(fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
     }
 
     ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT);
 
+    // kernel drops events whose code isn't registered.
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_SEC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_USEC);
+
     // set the misc events maps
     // ioctl(fd, UI_SET_EVBIT, EV_ABS);
     // ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_X);
     // ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y);
 
 
-    // register the input device
-    if (write(fd, &uinp, sizeof(uinp)) != sizeof(uinp)) {
-        ALOGE("Cannot write uinput_user_dev to fd %d: %s.", fd, strerror(errno));
-        close(fd);
-        return NULL;
+    if (!registerDevice(fd, uinp)) {
+        return nullptr;
     }
-    if (ioctl(fd, UI_DEV_CREATE) != 0) {
-        ALOGE("Unable to create uinput device: %s.", strerror(errno));
-        close(fd);
+    return new NativeConnection(fd, maxPointers, false);
+}
+
+NativeConnection* NativeConnection::openKeyboard(const char* name, const char* uniqueId) {
+    ALOGI("Registering keyboard uinput device %s", name);
+
+    int fd = ::open("/dev/uinput", O_WRONLY | O_NDELAY);
+    if (fd < 0) {
+        ALOGE("Cannot open /dev/uinput: %s.", strerror(errno));
         return nullptr;
     }
 
-    ALOGD("Created uinput device, fd=%d.", fd);
-    return new NativeConnection(fd, maxPointers);
+    struct uinput_user_dev uinp;
+    memset(&uinp, 0, sizeof(struct uinput_user_dev));
+    strlcpy(uinp.name, name, UINPUT_MAX_NAME_SIZE);
+    uinp.id.version = 1;
+    uinp.id.bustype = BUS_VIRTUAL;
+
+    ioctl(fd, UI_SET_PHYS, uniqueId);
+
+    // only keys, InputReader creates KeyboardInputMapper alone, pointer events don't go through it.
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    for (size_t i = 0; i < NELEM(KEYS); i++) {
+        ioctl(fd, UI_SET_KEYBIT, KEYS[i].linuxKeyCode);
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_SEC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_USEC);
+
+    if (!registerDevice(fd, uinp)) {
+        return nullptr;
+    }
+    return new NativeConnection(fd, 0, false);
+}
+
+NativeConnection* NativeConnection::openRelative(const char* name, const char* uniqueId) {
+    ALOGI("Registering relative mouse uinput device %s", name);
+
+    int fd = ::open("/dev/uinput", O_WRONLY | O_NDELAY);
+    if (fd < 0) {
+        ALOGE("Cannot open /dev/uinput: %s.", strerror(errno));
+        return nullptr;
+    }
+
+    struct uinput_user_dev uinp;
+    memset(&uinp, 0, sizeof(struct uinput_user_dev));
+    strlcpy(uinp.name, name, UINPUT_MAX_NAME_SIZE);
+    uinp.id.version = 1;
+    uinp.id.bustype = BUS_VIRTUAL;
+
+    ioctl(fd, UI_SET_PHYS, uniqueId);
+
+    // BTN_MOUSE(BTN_LEFT) and REL_X/REL_Y make it a cursor device.
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
+    ioctl(fd, UI_SET_KEYBIT, BTN_MIDDLE);
+
+    ioctl(fd, UI_SET_EVBIT, EV_REL);
+    ioctl(fd, UI_SET_RELBIT, REL_X);
+    ioctl(fd, UI_SET_RELBIT, REL_Y);
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL);
+    ioctl(fd, UI_SET_RELBIT, REL_HWHEEL);
+    ioctl(fd, UI_SET_RELBIT, REL_WHEEL_HI_RES);
+    ioctl(fd, UI_SET_RELBIT, REL_HWHEEL_HI_RES);
+
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_SEC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_USEC);
+
+    if (!registerDevice(fd, uinp)) {
+        return nullptr;
+    }
+    return new NativeConnection(fd, 1, false);
+}
+
+NativeConnection* NativeConnection::openTouch(const char* name, const char* uniqueId,
+        int32_t screenWidth, int32_t screenHeight) {
+    ALOGI("Registering multi-touch uinput device %s: size %dx%d", name, screenWidth, screenHeight);
+
+    int fd = ::open("/dev/uinput", O_WRONLY | O_NDELAY);
+    if (fd < 0) {
+        ALOGE("Cannot open /dev/uinput: %s.", strerror(errno));
+        return nullptr;
+    }
+
+    struct uinput_user_dev uinp;
+    memset(&uinp, 0, sizeof(struct uinput_user_dev));
+    strlcpy(uinp.name, name, UINPUT_MAX_NAME_SIZE);
+    uinp.id.version = 1;
+    uinp.id.bustype = BUS_VIRTUAL;
+    uinp.absmin[ABS_MT_SLOT] = 0;
+    uinp.absmax[ABS_MT_SLOT] = KOS_MAX_TOUCH_CONTACTS - 1;
+    uinp.absmin[ABS_MT_TRACKING_ID] = 0;
+    uinp.absmax[ABS_MT_TRACKING_ID] = 0xffff;
+    uinp.absmin[ABS_MT_POSITION_X] = 0;
+    uinp.absmax[ABS_MT_POSITION_X] = screenWidth - 1;
+    uinp.absmin[ABS_MT_POSITION_Y] = 0;
+    uinp.absmax[ABS_MT_POSITION_Y] = screenHeight - 1;
+
+    ioctl(fd, UI_SET_PHYS, uniqueId);
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    ioctl(fd, UI_SET_KEYBIT, BTN_TOUCH);
+
+    // without ABS_X/ABS_Y, InputReader creates MultiTouchInputMapper.
+    ioctl(fd, UI_SET_EVBIT, EV_ABS);
+    ioctl(fd, UI_SET_ABSBIT, ABS_MT_SLOT);
+    ioctl(fd, UI_SET_ABSBIT, ABS_MT_TRACKING_ID);
+    ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_X);
+    ioctl(fd, UI_SET_ABSBIT, ABS_MT_POSITION_Y);
+
+    ioctl(fd, UI_SET_PROPBIT, INPUT_PROP_DIRECT);
+
+    ioctl(fd, UI_SET_EVBIT, EV_MSC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_SEC);
+    ioctl(fd, UI_SET_MSCBIT, MSC_ANDROID_TIME_USEC);
+
+    if (!registerDevice(fd, uinp)) {
+        return nullptr;
+    }
+    return new NativeConnection(fd, KOS_MAX_TOUCH_CONTACTS, true);
+}
+
+NativeConnection* NativeConnection::adopt(int fd, int32_t maxPointers, bool multiTouch) {
+    return new NativeConnection(fd, maxPointers, multiTouch);
 }
 
 void NativeConnection::sendEvent(int32_t type, int32_t code, int32_t value) {
-    struct input_event iev;
+    if (type == EV_SYN) {
+        mFrameCodeCount = 0;
+        mFrameStarted = false;
+
+    } else if (!mMultiTouch) {
+        // multi-touch repeats ABS_MT_* per slot in one frame, send_touch ends frame by itself.
+        const uint32_t key = (uint32_t)type << 16 | (uint32_t)code;
+        bool repeated = mFrameCodeCount == (int)NELEM(mFrameCodes);
+        for (int n = 0; n < mFrameCodeCount && !repeated; n ++) {
+            repeated = mFrameCodes[n] == key;
+        }
+        if (repeated) {
+            // end current frame, this event starts a new one.
+            sendEvent(EV_SYN, SYN_REPORT, 0);
+        }
+        mFrameCodes[mFrameCodeCount ++] = key;
+    }
+
+    if (type != EV_SYN && !mFrameStarted) {
+        mFrameStarted = true;
+        const int64_t usec = mTimestampUsec;
+        if (usec != 0) {
+            nativeSendTimestamp(usec);
+        }
+    }
+
+    struct input_event& iev = mEvents[mEventCount ++];
     memset(&iev, 0, sizeof(iev));
     iev.type = type;
     iev.code = code;
     iev.value = value;
-    write(mFd, &iev, sizeof(iev));
+    if (type == EV_SYN || mEventCount == (int)NELEM(mEvents)) {
+        flush();
+    }
 }
 
-void NativeConnection::nativeSendTimestamp(long timestamp) {
-    sendEvent(EV_MSC, MSC_ANDROID_TIME_SEC, timestamp / 1000L);
-    sendEvent(EV_MSC, MSC_ANDROID_TIME_USEC, (timestamp % 1000L) * 1000L);
+void NativeConnection::flush() {
+    if (mEventCount == 0) {
+        return;
+    }
+    const ssize_t bytes = mEventCount * sizeof(struct input_event);
+    ssize_t ret;
+    do {
+        ret = write(mFd, mEvents, bytes);
+    } while (ret < 0 && errno == EINTR);
+    if (ret != bytes) {
+        ALOGE("NativeConnection::flush, write %d events to fd %d fail: %s", mEventCount, mFd, strerror(errno));
+    }
+    mEventCount = 0;
+}
+
+void NativeConnection::nativeSendTimestamp(int64_t usec) {
+    sendEvent(EV_MSC, MSC_ANDROID_TIME_SEC, usec / 1000000LL);
+    sendEvent(EV_MSC, MSC_ANDROID_TIME_USEC, usec % 1000000LL);
 }
 
 void NativeConnection::nativeSendKey(int keyCode, bool down) {
@@ -957,7 +1272,16 @@ bool NativeConnection::nativeSendPointerMove(int x, int y)
 
 void NativeConnection::nativeSendWheel(bool vertical, int val)
 {
-    sendEvent(EV_REL, vertical? REL_WHEEL: REL_HWHEEL, val > 0? 1: -1);
+    // val is in WHEEL_DELTA units. high-resolution reader gets it as is, REL_WHEEL/REL_HWHEEL get
+    // whole notches, the rest is accumulated, so smooth-scrolling clients don't scroll a notch per event.
+    sendEvent(EV_REL, vertical? REL_WHEEL_HI_RES: REL_HWHEEL_HI_RES, val);
+    int32_t& remainder = vertical? mWheelRemainder: mHWheelRemainder;
+    remainder += val;
+    const int32_t notches = remainder / WHEEL_DELTA;
+    if (notches != 0) {
+        sendEvent(EV_REL, vertical? REL_WHEEL: REL_HWHEEL, notches);
+        remainder -= notches * WHEEL_DELTA;
+    }
 }
 
 void NativeConnection::nativeSendPointerSync() {
@@ -965,8 +1289,30 @@ void NativeConnection::nativeSendPointerSync() {
 }
 
 void NativeConnection::nativeClear() {
-    nativeSendPointerUp(1, -1, -1);
+    if (mMultiTouch) {
+        // lift all contacts.
+        for (int32_t slot = 0; slot < KOS_MAX_TOUCH_CONTACTS; slot ++) {
+            if (mActiveSlots & (1u << slot)) {
+                sendEvent(EV_ABS, ABS_MT_SLOT, slot);
+                sendEvent(EV_ABS, ABS_MT_TRACKING_ID, -1);
+            }
+        }
+        mActiveSlots = 0;
+        mCurrentSlot = -1;
+        endTouchFrame();
+        return;
+    }
+
     // nativeSendPointerUp(0, -1, -1);
+    // buttons of absolute and relative mouse. kernel drops the one device hasn't.
+    sendEvent(EV_KEY, BTN_LEFT, 0);
+    sendEvent(EV_KEY, BTN_RIGHT, 0);
+    sendEvent(EV_KEY, BTN_MIDDLE, 0);
+    mRelRemainderX = 0;
+    mRelRemainderY = 0;
+    mWheelRemainder = 0;
+    mHWheelRemainder = 0;
+    mRelHasLast = false;
 
     // Clear keys.
     for (size_t i = 0; i < NELEM(KEYS); i++) {
@@ -1022,7 +1368,7 @@ uint32_t NativeConnection::send_input(uint32_t input_count, KosInput* inputs)
                 nativeSendPointerMove(x, y);
             }
         } else if (src->type == KOS_INPUT_KEYBOARD) {
-            int android_scan_code = win_scan_code_2_android_scan_code(src->u.ki.scan_code);
+            int android_scan_code = win_scan_code_2_android_scan_code(src->u.ki.scan_code, src->u.ki.flags & KEYEVENTF_EXTENDEDKEY);
             if (android_scan_code != -1) {
                 requireSend = true;
                 nativeSendKey(android_scan_code, src->u.ki.flags & KEYEVENTF_KEYUP? false: true);
@@ -1032,7 +1378,430 @@ uint32_t NativeConnection::send_input(uint32_t input_count, KosInput* inputs)
     if (requireSend) {
         sendEvent(EV_SYN, SYN_REPORT, 0);
     }
+    flush();
+    return input_count;
+}
+
+uint32_t NativeConnection::send_relative(uint32_t input_count, const KosInput* inputs)
+{
+    bool requireSend = false;
+    for (int n = 0; n < (int)input_count; n ++) {
+        if (inputs[n].type != KOS_INPUT_MOUSE) {
+            continue;
+        }
+        const KosMouseInput& mi = inputs[n].u.mi;
+        int32_t dx = 0;
+        int32_t dy = 0;
+        if (mi.flags & MOUSEEVENTF_ABSOLUTE) {
+            // RDP clients send absolute positions only, cursor device moves by delta from previous one.
+            // first position after nativeClear is only an origin.
+            if (mRelHasLast) {
+                dx = mi.dx - mRelLastX;
+                dy = mi.dy - mRelLastY;
+            }
+            mRelHasLast = true;
+            mRelLastX = mi.dx;
+            mRelLastY = mi.dy;
+        } else if (mi.flags & MOUSEEVENTF_MOVE) {
+            dx = mi.dx;
+            dy = mi.dy;
+        }
+        if (dx != 0 || dy != 0) {
+            mRelRemainderX += (int64_t)dx * mRelativeScale;
+            mRelRemainderY += (int64_t)dy * mRelativeScale;
+            const int32_t x = (int32_t)(mRelRemainderX / 1000);
+            const int32_t y = (int32_t)(mRelRemainderY / 1000);
+            mRelRemainderX -= (int64_t)x * 1000;
+            mRelRemainderY -= (int64_t)y * 1000;
+            if (x != 0) {
+                sendEvent(EV_REL, REL_X, x);
+            }
+            if (y != 0) {
+                sendEvent(EV_REL, REL_Y, y);
+            }
+            requireSend = requireSend || x != 0 || y != 0;
+        }
+        // one input can carry move and button.
+        const struct {
+            uint32_t flag;
+            int32_t code;
+            int32_t value;
+        } buttons[] = {
+            {MOUSEEVENTF_LEFTDOWN, BTN_LEFT, 1}, {MOUSEEVENTF_LEFTUP, BTN_LEFT, 0},
+            {MOUSEEVENTF_RIGHTDOWN, BTN_RIGHT, 1}, {MOUSEEVENTF_RIGHTUP, BTN_RIGHT, 0},
+            {MOUSEEVENTF_MIDDLEDOWN, BTN_MIDDLE, 1}, {MOUSEEVENTF_MIDDLEUP, BTN_MIDDLE, 0},
+        };
+        for (size_t i = 0; i < NELEM(buttons); i++) {
+            if (mi.flags & buttons[i].flag) {
+                sendEvent(EV_KEY, buttons[i].code, buttons[i].value);
+                requireSend = true;
+            }
+        }
+        if ((mi.flags & (MOUSEEVENTF_WHEEL | MOUSEEVENTF_HWHEEL)) && mi.mouse_data != 0) {
+            nativeSendWheel(mi.flags & MOUSEEVENTF_WHEEL, (int32_t)mi.mouse_data);
+            requireSend = true;
+        }
+    }
+    if (requireSend) {
+        sendEvent(EV_SYN, SYN_REPORT, 0);
+    }
+    flush();
+    return input_count;
+}
+
+void NativeConnection::endTouchFrame() {
+    const bool touching = mActiveSlots != 0;
+    if (touching != mTouching) {
+        sendEvent(EV_KEY, BTN_TOUCH, touching? 1: 0);
+        mTouching = touching;
+    }
+    sendEvent(EV_SYN, SYN_REPORT, 0);
+}
+
+uint32_t NativeConnection::send_touch(uint32_t input_count, const KosInput* inputs)
+{
+    // slots changed in current frame. a contact that changes twice, for example down and up
+    // of a quick tap, requires a new frame, or InputReader sees final state only.
+    uint32_t frameSlots = 0;
+    bool requireSend = false;
+    for (int n = 0; n < (int)input_count; n ++) {
+        const KosTouchInput& ti = inputs[n].u.ti;
+        if (inputs[n].type != KOS_INPUT_TOUCH || ti.contact_id >= KOS_MAX_TOUCH_CONTACTS) {
+            continue;
+        }
+        const int32_t slot = ti.contact_id;
+        const uint32_t bit = 1u << slot;
+        const bool active = mActiveSlots & bit;
+        if (!active && !(ti.flags & TOUCHEVENTF_DOWN)) {
+            // move or up of contact that isn't down. down of active contact is taken as move.
+            continue;
+        }
+
+        if (frameSlots & bit) {
+            endTouchFrame();
+            frameSlots = 0;
+        }
+        if (slot != mCurrentSlot) {
+            sendEvent(EV_ABS, ABS_MT_SLOT, slot);
+            mCurrentSlot = slot;
+        }
+        if (ti.flags & (TOUCHEVENTF_UP | TOUCHEVENTF_CANCEL)) {
+            sendEvent(EV_ABS, ABS_MT_TRACKING_ID, -1);
+            mActiveSlots &= ~bit;
+
+        } else {
+            if (!active) {
+                sendEvent(EV_ABS, ABS_MT_TRACKING_ID, mNextTrackingId);
+                mNextTrackingId = (mNextTrackingId + 1) & 0xffff;
+                mActiveSlots |= bit;
+            }
+            sendEvent(EV_ABS, ABS_MT_POSITION_X, ti.x);
+            sendEvent(EV_ABS, ABS_MT_POSITION_Y, ti.y);
+        }
+        frameSlots |= bit;
+        requireSend = true;
+    }
+    if (requireSend) {
+        endTouchFrame();
+    }
+    flush();
     return input_count;
 }
 
+InputCoalescer::InputCoalescer(NativeConnection& connection, int maxDelayMs) :
+    mConnection(connection)
+    , mMaxDelay(milliseconds_to_nanoseconds(maxDelayMs > 0? maxDelayMs: 0))
+    , mExit(false)
+    , mHasPending(false)
+    , mPendingSince(0)
+    , mPendingUsec(0)
+    , mReceivedMoves(0)
+    , mInjectedMoves(0) {
+    ALOGI("InputCoalescer, max delay: %i ms", maxDelayMs);
+    memset(&mPending, 0, sizeof(mPending));
+    if (mMaxDelay > 0) {
+        mThread = std::thread(&InputCoalescer::threadLoop, this);
+    }
+}
+
+InputCoalescer::~InputCoalescer() {
+    {
+        Mutex::Autolock _l(mLock);
+        mExit = true;
+        mCondition.signal();
+    }
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+    if (mHasPending) {
+        injectPending();
+    }
+    ALOGI("InputCoalescer, received %llu moves, injected %llu",
+            (unsigned long long)mReceivedMoves, (unsigned long long)mInjectedMoves);
+}
+
+bool InputCoalescer::isCoalescable(const KosInput& input) {
+    const uint32_t transitions = MOUSEEVENTF_LEFTDOWN | MOUSEEVENTF_LEFTUP | MOUSEEVENTF_RIGHTDOWN | MOUSEEVENTF_RIGHTUP
+            | MOUSEEVENTF_MIDDLEDOWN | MOUSEEVENTF_MIDDLEUP | MOUSEEVENTF_XDOWN | MOUSEEVENTF_XUP
+            | MOUSEEVENTF_WHEEL | MOUSEEVENTF_HWHEEL | MOUSEEVENTF_MOVE_NOCOALESCE;
+    return input.type == KOS_INPUT_MOUSE && (input.u.mi.flags & MOUSEEVENTF_ABSOLUTE)
+            && !(input.u.mi.flags & transitions);
+}
+
+void InputCoalescer::injectPending() {
+    mConnection.setTimestamp(mPendingUsec);
+    mConnection.send_input(1, &mPending);
+    mHasPending = false;
+    mInjectedMoves ++;
+}
+
+void InputCoalescer::takePending(int64_t usec) {
+    if (mPendingUsec == usec) {
+        mOut.push_back(mPending);
+        mHasPending = false;
+        mInjectedMoves ++;
+        return;
+    }
+    // held from an earlier batch. inputs before it in mOut, if any, go first.
+    if (!mOut.empty()) {
+        mConnection.setTimestamp(usec);
+        mConnection.send_input(mOut.size(), mOut.data());
+        mOut.clear();
+    }
+    injectPending();
+}
+
+uint32_t InputCoalescer::send_input(uint32_t input_count, const KosInput* inputs, int64_t usec) {
+    Mutex::Autolock _l(mLock);
+    mOut.clear();
+    for (int n = 0; n < (int)input_count; n ++) {
+        const KosInput& input = inputs[n];
+        if (!isCoalescable(input)) {
+            if (mHasPending) {
+                takePending(usec);
+            }
+            mOut.push_back(input);
+            continue;
+        }
+
+        mReceivedMoves ++;
+        if (mMaxDelay == 0) {
+            mOut.push_back(input);
+            mInjectedMoves ++;
+
+        } else {
+            if (!mHasPending) {
+                mHasPending = true;
+                mPendingSince = systemTime(SYSTEM_TIME_MONOTONIC);
+                mCondition.signal();
+            }
+            mPending = input;
+            mPendingUsec = usec;
+        }
+    }
+    // in a steady drag, caller injects on time, flush thread needn't wake up.
+    if (mHasPending && systemTime(SYSTEM_TIME_MONOTONIC) - mPendingSince >= mMaxDelay) {
+        takePending(usec);
+    }
+    if (!mOut.empty()) {
+        mConnection.setTimestamp(usec);
+        mConnection.send_input(mOut.size(), mOut.data());
+    }
+    return input_count;
+}
+
+void InputCoalescer::flush() {
+    Mutex::Autolock _l(mLock);
+    if (mHasPending) {
+        injectPending();
+    }
+}
+
+void InputCoalescer::threadLoop() {
+    Mutex::Autolock _l(mLock);
+    while (!mExit) {
+        if (!mHasPending) {
+            mCondition.wait(mLock);
+            continue;
+        }
+        const nsecs_t remaining = mPendingSince + mMaxDelay - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (remaining > 0) {
+            mCondition.waitRelative(mLock, remaining);
+            continue;
+        }
+        injectPending();
+    }
+}
+
+InputDeviceRegistry& InputDeviceRegistry::instance() {
+    // never destroyed, devices live until process exits.
+    static InputDeviceRegistry* registry = new InputDeviceRegistry;
+    return *registry;
+}
+
+InputDeviceRegistry::InputDeviceRegistry() :
+    mRelativeMouse(false)
+    , mTouchDeferred(false)
+    , mTouchWidth(0)
+    , mTouchHeight(0) {
+    memset(mEntries, 0, sizeof(mEntries));
+}
+
+NativeConnection* InputDeviceRegistry::acquire(int kind, int32_t screenWidth, int32_t screenHeight) {
+    if (kind < KOS_INPUT_DEVICE_KEYBOARD || kind > kKindCount) {
+        ALOGE("InputDeviceRegistry::acquire, invalid kind: %i", kind);
+        return nullptr;
+    }
+    Mutex::Autolock _l(mLock);
+    return acquireLocked(kind, screenWidth, screenHeight);
+}
+
+void InputDeviceRegistry::deferTouch(int32_t screenWidth, int32_t screenHeight) {
+    Mutex::Autolock _l(mLock);
+    Entry& entry = mEntries[KOS_INPUT_DEVICE_TOUCH - 1];
+    if (entry.acquired && entry.width == screenWidth && entry.height == screenHeight) {
+        return;
+    }
+    mTouchDeferred = true;
+    mTouchWidth = screenWidth;
+    mTouchHeight = screenHeight;
+}
+
+NativeConnection* InputDeviceRegistry::acquireLocked(int kind, int32_t screenWidth, int32_t screenHeight) {
+    Entry& entry = mEntries[kind - 1];
+    if (kind == KOS_INPUT_DEVICE_TOUCH) {
+        mTouchDeferred = false;
+    }
+    if (entry.connection != nullptr && (kind == KOS_INPUT_DEVICE_MOUSE || kind == KOS_INPUT_DEVICE_TOUCH)
+            && (entry.width != screenWidth || entry.height != screenHeight)) {
+        // absmax is fixed when UI_DEV_CREATE.
+        ALOGI("InputDeviceRegistry, display changed from %dx%d to %dx%d, recreate device %i",
+                entry.width, entry.height, screenWidth, screenHeight, kind);
+        delete entry.coalescer;
+        entry.coalescer = nullptr;
+        delete entry.connection;
+        entry.connection = nullptr;
+        // if reopen fails, inject and release must not reach the deleted device.
+        entry.acquired = false;
+    }
+    if (entry.connection == nullptr) {
+        if (kind == KOS_INPUT_DEVICE_KEYBOARD) {
+            entry.connection = NativeConnection::openKeyboard("RDP keyboard", "com.kos.launcher.keyboard");
+        } else if (kind == KOS_INPUT_DEVICE_MOUSE) {
+            entry.connection = NativeConnection::open("RDP uinput", "com.kos.launcher", false, screenWidth, screenHeight);
+        } else if (kind == KOS_INPUT_DEVICE_RELATIVE_MOUSE) {
+            entry.connection = NativeConnection::openRelative("RDP mouse", "com.kos.launcher.mouse");
+        } else {
+            entry.connection = NativeConnection::openTouch("RDP touch", "com.kos.launcher.touch", screenWidth, screenHeight);
+        }
+        if (entry.connection == nullptr) {
+            return nullptr;
+        }
+        entry.width = screenWidth;
+        entry.height = screenHeight;
+    }
+    if (kind == KOS_INPUT_DEVICE_MOUSE && entry.coalescer == nullptr) {
+        // max delay of a merged move, 0 disables merging.
+        char value[PROPERTY_VALUE_MAX];
+        int coalesce_ms = 4;
+        if (property_get("kos.input.coalesce_ms", value, NULL) > 0) {
+            coalesce_ms = atoi(value);
+        }
+        entry.coalescer = new InputCoalescer(*entry.connection, coalesce_ms);
+    }
+    entry.acquired = true;
+    return entry.connection;
+}
+
+void InputDeviceRegistry::release(int kind) {
+    if (kind < KOS_INPUT_DEVICE_KEYBOARD || kind > kKindCount) {
+        return;
+    }
+    Mutex::Autolock _l(mLock);
+    Entry& entry = mEntries[kind - 1];
+    if (kind == KOS_INPUT_DEVICE_RELATIVE_MOUSE) {
+        mRelativeMouse = false;
+    } else if (kind == KOS_INPUT_DEVICE_TOUCH) {
+        mTouchDeferred = false;
+    }
+    if (!entry.acquired) {
+        return;
+    }
+    entry.acquired = false;
+    // flush held move, flush thread needn't run between sessions.
+    delete entry.coalescer;
+    entry.coalescer = nullptr;
+    // these aren't of any injected batch, let them carry kernel's time.
+    entry.connection->setTimestamp(0);
+    entry.connection->nativeClear();
+}
+
+void InputDeviceRegistry::inject(uint32_t input_count, KosInput* inputs, int64_t usec) {
+    Mutex::Autolock _l(mLock);
+    for (int kind = KOS_INPUT_DEVICE_KEYBOARD; kind <= kKindCount; kind ++) {
+        // device behind a coalescer gets usec from it, its flush thread may be injecting an older move.
+        if (mEntries[kind - 1].acquired && mEntries[kind - 1].coalescer == nullptr) {
+            mEntries[kind - 1].connection->setTimestamp(usec);
+        }
+    }
+
+    uint32_t start = 0;
+    while (start < input_count) {
+        const uint32_t type = inputs[start].type;
+        uint32_t end = start + 1;
+        while (end < input_count && inputs[end].type == type) {
+            end ++;
+        }
+        const int kind = type == KOS_INPUT_KEYBOARD? KOS_INPUT_DEVICE_KEYBOARD:
+                type == KOS_INPUT_MOUSE? (mRelativeMouse? KOS_INPUT_DEVICE_RELATIVE_MOUSE: KOS_INPUT_DEVICE_MOUSE):
+                type == KOS_INPUT_TOUCH? KOS_INPUT_DEVICE_TOUCH: 0;
+        if (kind == KOS_INPUT_DEVICE_TOUCH && mTouchDeferred) {
+            // if kernel fails to create it, touch inputs are dropped, and it isn't tried again.
+            NativeConnection* connection = acquireLocked(kind, mTouchWidth, mTouchHeight);
+            if (connection != nullptr) {
+                connection->setTimestamp(usec);
+            }
+        }
+        if (kind != 0 && mEntries[kind - 1].acquired) {
+            Entry& entry = mEntries[kind - 1];
+            if (entry.coalescer != nullptr) {
+                entry.coalescer->send_input(end - start, inputs + start, usec);
+                start = end;
+                continue;
+            }
+            // keys, buttons and touches go to other devices than a held move, and InputReader reads
+            // every device on its own. inject held move first, or a move sent before a key could be read after it.
+            for (int other = KOS_INPUT_DEVICE_KEYBOARD; other <= kKindCount; other ++) {
+                if (mEntries[other - 1].coalescer != nullptr) {
+                    mEntries[other - 1].coalescer->flush();
+                }
+            }
+            if (kind == KOS_INPUT_DEVICE_TOUCH) {
+                entry.connection->send_touch(end - start, inputs + start);
+            } else if (kind == KOS_INPUT_DEVICE_RELATIVE_MOUSE) {
+                entry.connection->send_relative(end - start, inputs + start);
+            } else {
+                entry.connection->send_input(end - start, inputs + start);
+            }
+        }
+        start = end;
+    }
+}
+
+bool InputDeviceRegistry::setMouseMode(int mode, int scalePermille) {
+    if (mode != KOS_MOUSE_MODE_RELATIVE) {
+        // lift buttons that are down on relative device.
+        release(KOS_INPUT_DEVICE_RELATIVE_MOUSE);
+        return true;
+    }
+    NativeConnection* connection = acquire(KOS_INPUT_DEVICE_RELATIVE_MOUSE, 0, 0);
+    if (connection == nullptr) {
+        return false;
+    }
+    Mutex::Autolock _l(mLock);
+    connection->setRelativeScale(scalePermille > 0? scalePermille: 1000);
+    mRelativeMouse = true;
+    return true;
+}
+
 } // namespace android
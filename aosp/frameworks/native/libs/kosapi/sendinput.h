@@ -3,6 +3,13 @@
 
 #include <android/keycodes.h>
 #include <linux/input.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <utils/Condition.h>
+#include <utils/Mutex.h>
+#include <utils/Timers.h>
 
 #include <kosapi/sys.h>
 
@@ -17,7 +24,7 @@ struct Key {
 
 // List of all of the keycodes that the emote is capable of sending.
 // sort by linuxKeyCode that from <aosp>/kernel/include/dt-bindings/input/linux-event-codes.h
-static Key KEYS[] = {
+static constexpr Key KEYS[] = {
     { KEY_ESC, AKEYCODE_ESCAPE },
 
     { KEY_1, AKEYCODE_1 },
@@ -119,18 +126,18 @@ static Key KEYS[] = {
     { KEY_KATAKANAHIRAGANA	93
     { KEY_MUHENKAN		94
     { KEY_KPJPCOMMA		95
-    { KEY_KPENTER		96
 */
+    { KEY_KPENTER, AKEYCODE_NUMPAD_ENTER},
     { KEY_RIGHTCTRL, AKEYCODE_CTRL_RIGHT},
+    { KEY_KPSLASH, AKEYCODE_NUMPAD_DIVIDE},
 /*
-    { KEY_KPSLASH		98
     { KEY_SYSRQ		99
 */
     { KEY_RIGHTALT, AKEYCODE_ALT_RIGHT},
 /*
     { KEY_LINEFEED		101
-    { KEY_HOME		102
 */
+    { KEY_HOME, AKEYCODE_MOVE_HOME},
     { KEY_UP, AKEYCODE_DPAD_UP},
     { KEY_PAGEUP, AKEYCODE_PAGE_UP},
     { KEY_LEFT, AKEYCODE_DPAD_LEFT},
@@ -149,12 +156,24 @@ public:
     // @screenWidth, screenHeight: width/height when orientation is DISPLAY_ORIENTATION_0 although current in DISPLAY_ORIENTATION_90/270.
     static NativeConnection* open(const char* name, const char* uniqueId,
             bool keyboard, int32_t screenWidth, int32_t screenHeight);
+    // keys of KEYS only, no pointer.
+    static NativeConnection* openKeyboard(const char* name, const char* uniqueId);
+    // mouse of REL_X/REL_Y, InputReader creates CursorInputMapper.
+    static NativeConnection* openRelative(const char* name, const char* uniqueId);
+    // multi-touch device of protocol B(ABS_MT_SLOT/ABS_MT_TRACKING_ID), one slot per contact.
+    static NativeConnection* openTouch(const char* name, const char* uniqueId,
+            int32_t screenWidth, int32_t screenHeight);
+    // take an opened fd that isn't uinput, for example a socket of host benchmark. it is closed when destroyed.
+    static NativeConnection* adopt(int fd, int32_t maxPointers, bool multiTouch);
 
     void sendEvent(int32_t type, int32_t code, int32_t value);
 
     int32_t getMaxPointers() const { return mMaxPointers; }
 
-    void nativeSendTimestamp(long timestamp);
+    // every frame after it starts with MSC_ANDROID_TIME_SEC/USEC of usec(CLOCK_MONOTONIC),
+    // so InputReader sees time that input is injected, not time that it is written.
+    void setTimestamp(int64_t usec) { mTimestampUsec = usec; }
+    void nativeSendTimestamp(int64_t usec);
     void nativeSendKey(int keyCode, bool down);
     void nativeSendPointerDown(int pointerId, int x, int y);
     void nativeSendPointerUp(int pointerId, int x, int y);
@@ -163,14 +182,141 @@ public:
     void nativeSendWheel(bool vertical, int val);
     void nativeClear();
     uint32_t send_input(uint32_t input_count, KosInput* inputs);
+    // inputs must be KOS_INPUT_TOUCH, all are one frame.
+    uint32_t send_touch(uint32_t input_count, const KosInput* inputs);
+    // inputs must be KOS_INPUT_MOUSE, for device of openRelative.
+    uint32_t send_relative(uint32_t input_count, const KosInput* inputs);
+    // deltas of relative move are multiplied by permille / 1000.
+    void setRelativeScale(int32_t permille) { mRelativeScale = permille; }
 
 private:
-    NativeConnection(int fd, int32_t maxPointers);
+    NativeConnection(int fd, int32_t maxPointers, bool multiTouch);
+    // write buffered events by one write().
+    void flush();
+    void endTouchFrame();
 
     const int mFd;
     const int32_t mMaxPointers;
     int lastX;
     int lastY;
+
+    // multi-touch state. a bit of mActiveSlots is set when that slot has a tracking id.
+    const bool mMultiTouch;
+    int32_t mCurrentSlot;
+    int32_t mNextTrackingId;
+    uint32_t mActiveSlots;
+    bool mTouching;
+
+    // relative move and wheel, remainders are carried to next event.
+    int32_t mRelativeScale;
+    int64_t mRelRemainderX; // 1/1000 pixel
+    int64_t mRelRemainderY;
+    int32_t mWheelRemainder; // WHEEL_DELTA(120) is one notch
+    int32_t mHWheelRemainder;
+    // previous absolute position, an absolute move is sent as delta from it.
+    bool mRelHasLast;
+    int32_t mRelLastX;
+    int32_t mRelLastY;
+
+    // of mouse device, set only under InputCoalescer's lock, by injecting thread or flush thread.
+    std::atomic<int64_t> mTimestampUsec;
+    bool mFrameStarted;
+
+    // (type << 16 | code) of events written since last SYN_REPORT.
+    // a code can change only once in a frame, or InputReader sees final state only, a tap in batch is lost.
+    uint32_t mFrameCodes[16];
+    int mFrameCodeCount;
+
+    // events of current frame, flushed at SYN_REPORT. uinput accepts many events in one write,
+    // so a pointer down costs one syscall instead of four.
+    // 64 holds a full multi-touch frame: 4 events per contact, BTN_TOUCH and SYN_REPORT.
+    struct input_event mEvents[64];
+    int mEventCount;
+};
+
+// In front of NativeConnection, merges consecutive absolute moves between button and key transitions.
+// A move is held at most maxDelayMs, then the latest one is injected by flush thread. Any other input
+// injects held move first, so button and key transitions are never delayed or reordered.
+// MOUSEEVENTF_MOVE_NOCOALESCE moves aren't merged. maxDelayMs 0 disables merging.
+// Held move carries usec of the batch it came in, not of the batch that happens to inject it.
+class InputCoalescer {
+public:
+    InputCoalescer(NativeConnection& connection, int maxDelayMs);
+    ~InputCoalescer();
+
+    // usec is injected time of this batch, see InputDeviceRegistry::inject.
+    uint32_t send_input(uint32_t input_count, const KosInput* inputs, int64_t usec);
+    // inject held move now. called before an input of other device, so it can't land after that one.
+    void flush();
+
+private:
+    static bool isCoalescable(const KosInput& input);
+    void threadLoop();
+    // caller holds mLock. move held one to mOut if it has usec, else inject it alone with its own usec.
+    void takePending(int64_t usec);
+    void injectPending();
+
+    NativeConnection& mConnection;
+    const nsecs_t mMaxDelay;
+
+    Mutex mLock;
+    Condition mCondition;
+    std::thread mThread;
+    bool mExit;
+
+    bool mHasPending;
+    KosInput mPending;
+    nsecs_t mPendingSince;
+    int64_t mPendingUsec;
+    std::vector<KosInput> mOut;
+
+    // statistics, logged when destroyed.
+    uint64_t mReceivedMoves;
+    uint64_t mInjectedMoves;
+};
+
+// Devices of KOS_INPUT_DEVICE_xxx, see kosAcquireInputDevice. Inputs of mouse go through InputCoalescer.
+class InputDeviceRegistry {
+public:
+    static InputDeviceRegistry& instance();
+
+    // return nullptr if kernel fails to create it.
+    NativeConnection* acquire(int kind, int32_t screenWidth, int32_t screenHeight);
+    void release(int kind);
+    // acquire touch device when first KOS_INPUT_TOUCH is injected, a session without touch never
+    // creates it, so system doesn't see an INPUT_PROP_DIRECT device.
+    void deferTouch(int32_t screenWidth, int32_t screenHeight);
+
+    // split inputs to runs by device, every run is one frame of its device.
+    // usec is injected time, every frame carries it by MSC_ANDROID_TIME_SEC/USEC.
+    void inject(uint32_t input_count, KosInput* inputs, int64_t usec);
+    bool setMouseMode(int mode, int scalePermille);
+
+private:
+    InputDeviceRegistry();
+
+    // caller holds mLock.
+    NativeConnection* acquireLocked(int kind, int32_t screenWidth, int32_t screenHeight);
+
+    struct Entry {
+        NativeConnection* connection;
+        InputCoalescer* coalescer;
+        int32_t width;
+        int32_t height;
+        bool acquired;
+    };
+    static const int kKindCount = KOS_INPUT_DEVICE_RELATIVE_MOUSE;
+
+    // serialize acquire/release with inject, they may be called in different threads.
+    Mutex mLock;
+    // index is kind - 1
+    Entry mEntries[kKindCount];
+    // KOS_INPUT_MOUSE goes to KOS_INPUT_DEVICE_RELATIVE_MOUSE.
+    bool mRelativeMouse;
+    // set by deferTouch, cleared when touch is acquired or released.
+    bool mTouchDeferred;
+    int32_t mTouchWidth;
+    int32_t mTouchHeight;
 };
 
 } // namespace android
@@ -0,0 +1,176 @@
+// Host test of how one batch of inputs is cut into frames (SYN_REPORT), it isn't in Android.mk.
+// A batch is injected as few frames as possible, but a frame never changes a code twice and never
+// holds more than 16 distinct codes, otherwise InputReader sees final state only and a tap is lost.
+// A SOCK_SEQPACKET socket stands in for /dev/uinput.
+// Build on linux against AOSP headers and host libs:
+//   g++ -std=c++14 -O2 -I<aosp>/system/core/include -I../../include sendinput.cpp sendinput_batch_test.cpp -llog -lcutils -lutils -pthread
+// Run: ./a.out
+
+#include "sendinput.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace android;
+
+static int failures = 0;
+
+#define EXPECT(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: EXPECT(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef std::vector<struct input_event> Frame;
+
+// read all pending events of fd, and cut them at SYN_REPORT.
+static std::vector<Frame> readFrames(int fd) {
+    std::vector<Frame> frames;
+    Frame current;
+    struct input_event events[64];
+    ssize_t ret;
+    while ((ret = read(fd, events, sizeof(events))) > 0) {
+        for (int n = 0; n < (int)(ret / sizeof(events[0])); n++) {
+            if (events[n].type == EV_SYN && events[n].code == SYN_REPORT) {
+                frames.push_back(current);
+                current.clear();
+            } else {
+                current.push_back(events[n]);
+            }
+        }
+    }
+    // events without SYN_REPORT would never reach InputReader.
+    EXPECT(current.empty());
+    return frames;
+}
+
+static bool codeRepeated(const Frame& frame) {
+    for (size_t i = 0; i < frame.size(); i++) {
+        for (size_t j = i + 1; j < frame.size(); j++) {
+            if (frame[i].type == frame[j].type && frame[i].code == frame[j].code) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static int findFrame(const std::vector<Frame>& frames, int type, int code, int value) {
+    for (size_t at = 0; at < frames.size(); at++) {
+        for (const struct input_event& ev : frames[at]) {
+            if (ev.type == type && ev.code == code && ev.value == value) {
+                return (int)at;
+            }
+        }
+    }
+    return -1;
+}
+
+static KosInput mouse(uint32_t flags, int x, int y) {
+    KosInput input;
+    memset(&input, 0, sizeof(input));
+    input.type = KOS_INPUT_MOUSE;
+    input.u.mi.flags = flags | MOUSEEVENTF_ABSOLUTE;
+    input.u.mi.dx = x;
+    input.u.mi.dy = y;
+    return input;
+}
+
+static KosInput key(uint16_t scanCode, bool up) {
+    KosInput input;
+    memset(&input, 0, sizeof(input));
+    input.type = KOS_INPUT_KEYBOARD;
+    input.u.ki.scan_code = scanCode;
+    input.u.ki.flags = up? KEYEVENTF_KEYUP: 0;
+    return input;
+}
+
+// a click in one batch: down and up must be in different frames.
+static void testClick(NativeConnection* connection, int fd) {
+    std::vector<KosInput> inputs;
+    inputs.push_back(mouse(MOUSEEVENTF_MOVE, 100, 100));
+    inputs.push_back(mouse(MOUSEEVENTF_LEFTDOWN, 100, 100));
+    inputs.push_back(mouse(MOUSEEVENTF_MOVE, 200, 150));
+    inputs.push_back(mouse(MOUSEEVENTF_LEFTUP, 200, 150));
+    connection->send_input(inputs.size(), inputs.data());
+
+    const std::vector<Frame> frames = readFrames(fd);
+    for (const Frame& frame : frames) {
+        EXPECT(!codeRepeated(frame));
+    }
+    const int down = findFrame(frames, EV_KEY, BTN_TOUCH, 1);
+    const int up = findFrame(frames, EV_KEY, BTN_TOUCH, 0);
+    EXPECT(down != -1 && up != -1 && down < up);
+    EXPECT(findFrame(frames, EV_ABS, ABS_X, 200) != -1);
+    printf("click: %zu frames, down in frame %d, up in frame %d\n", frames.size(), down, up);
+}
+
+// 17 distinct keys down in one batch: 16 codes fill a frame, the 17th starts the next one.
+static void testDistinctCodes(NativeConnection* connection, int fd) {
+    // Q W E R T Y U I O P A S D F G H J
+    const uint16_t scanCodes[] = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,
+            0x1e, 0x1f, 0x20, 0x21, 0x22, 0x23, 0x24};
+    const int count = sizeof(scanCodes) / sizeof(scanCodes[0]);
+    std::vector<KosInput> inputs;
+    for (int n = 0; n < count; n++) {
+        inputs.push_back(key(scanCodes[n], false));
+    }
+    connection->send_input(inputs.size(), inputs.data());
+
+    const std::vector<Frame> frames = readFrames(fd);
+    EXPECT(frames.size() == 2);
+    if (frames.size() == 2) {
+        EXPECT(frames[0].size() == 16);
+        EXPECT(frames[1].size() == 1);
+    }
+    printf("%d distinct keys: %zu frames\n", count, frames.size());
+
+    for (int n = 0; n < count; n++) {
+        inputs[n] = key(scanCodes[n], true);
+    }
+    connection->send_input(inputs.size(), inputs.data());
+    readFrames(fd);
+}
+
+// a key typed twice in one batch: four frames, each transition is seen.
+static void testRepeatedKey(NativeConnection* connection, int fd) {
+    std::vector<KosInput> inputs;
+    for (int n = 0; n < 2; n++) {
+        inputs.push_back(key(0x1e, false));
+        inputs.push_back(key(0x1e, true));
+    }
+    connection->send_input(inputs.size(), inputs.data());
+
+    const std::vector<Frame> frames = readFrames(fd);
+    EXPECT(frames.size() == 4);
+    for (const Frame& frame : frames) {
+        EXPECT(frame.size() == 1);
+    }
+    printf("key typed twice: %zu frames\n", frames.size());
+}
+
+int main(int argc, char** argv) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    NativeConnection* connection = NativeConnection::adopt(fds[1], 2, false);
+    testClick(connection, fds[0]);
+    testDistinctCodes(connection, fds[0]);
+    testRepeatedKey(connection, fds[0]);
+    delete connection;
+    close(fds[0]);
+
+    printf("%s\n", failures == 0? "PASS": "FAIL");
+    return failures == 0? 0: 1;
+}
@@ -0,0 +1,121 @@
+// Host benchmark of InputCoalescer: moves injected and their latency, it isn't in Android.mk.
+// A simulated 1000 Hz drag arrives in packets of 8 moves every 8 ms, with a click every 100 packets.
+// A SOCK_SEQPACKET socket stands in for /dev/uinput, a reader thread timestamps every frame.
+// Build on linux against AOSP headers and host libs:
+//   g++ -std=c++14 -O2 -I<aosp>/system/core/include -I../../include sendinput.cpp sendinput_coalesce_bench.cpp -llog -lcutils -lutils -pthread
+// Run: ./a.out [packets]
+
+#include "sendinput.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace android;
+
+static const int kMovesPerPacket = 8;
+static const int kPacketIntervalUs = 8000;
+
+static int64_t nowUs() {
+    return systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
+}
+
+struct Result {
+    Result() : moves(0), injected(0), frames(0) {}
+
+    int moves;
+    int injected;
+    int frames;
+    // per injected move: time from kosSendInput of it to it leaving the connection.
+    std::vector<int64_t> latencyUs;
+};
+
+// x of every move is its sequence, so reader knows when it was sent.
+static Result run(int maxDelayMs, int packets) {
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds);
+
+    const int total = packets * kMovesPerPacket;
+    std::vector<int64_t> sentUs(total, 0);
+    Result result;
+    result.moves = total;
+
+    std::thread reader([&]() {
+        struct input_event events[64];
+        while (true) {
+            const ssize_t ret = recv(fds[0], events, sizeof(events), 0);
+            if (ret <= 0) {
+                break;
+            }
+            const int64_t now = nowUs();
+            result.frames++;
+            for (int n = 0; n < (int)(ret / sizeof(events[0])); n++) {
+                const struct input_event& ev = events[n];
+                if (ev.type == EV_ABS && ev.code == ABS_X && ev.value >= 0 && ev.value < total) {
+                    result.injected++;
+                    result.latencyUs.push_back(now - sentUs[ev.value]);
+                }
+            }
+        }
+    });
+
+    NativeConnection* connection = NativeConnection::adopt(fds[1], 1, false);
+    {
+        InputCoalescer coalescer(*connection, maxDelayMs);
+        KosInput batch[kMovesPerPacket + 1];
+        int seq = 0;
+        for (int packet = 0; packet < packets; packet++) {
+            int count = 0;
+            for (int n = 0; n < kMovesPerPacket; n++) {
+                KosInput& input = batch[count++];
+                memset(&input, 0, sizeof(input));
+                input.type = KOS_INPUT_MOUSE;
+                input.u.mi.flags = MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE;
+                input.u.mi.dx = seq;
+                input.u.mi.dy = 5;
+                sentUs[seq++] = nowUs();
+            }
+            if (packet % 100 == 50) {
+                KosInput& input = batch[count++];
+                memset(&input, 0, sizeof(input));
+                input.type = KOS_INPUT_MOUSE;
+                input.u.mi.flags = (packet / 100) % 2 == 0 ? MOUSEEVENTF_LEFTDOWN : MOUSEEVENTF_LEFTUP;
+            }
+            coalescer.send_input(count, batch, sentUs[seq - 1]);
+            usleep(kPacketIntervalUs);
+        }
+        // let flush thread inject the last held move.
+        usleep((maxDelayMs + 10) * 1000);
+    }
+    // closes fds[1], reader gets end of stream.
+    delete connection;
+    reader.join();
+    close(fds[0]);
+    return result;
+}
+
+static int64_t percentile(std::vector<int64_t> values, int p) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, values.size() * p / 100)];
+}
+
+int main(int argc, char** argv) {
+    const int packets = argc > 1 ? atoi(argv[1]) : 500;
+    const int delays[] = {0, 2, 4, 8, 16};
+    for (int delay : delays) {
+        const Result result = run(delay, packets);
+        printf("delay %2d ms: %d moves, %d injected (%.1fx fewer), %d frames, latency p50 %lld us, p99 %lld us, max %lld us\n",
+                delay, result.moves, result.injected, result.injected > 0 ? (double)result.moves / result.injected : 0.0,
+                result.frames, (long long)percentile(result.latencyUs, 50), (long long)percentile(result.latencyUs, 99),
+                (long long)percentile(result.latencyUs, 100));
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Host benchmark of key translation: gKeyTables against the linear scan it replaced, it isn't in Android.mk.
+// Every round translates all 2 x 128 windows scan codes to android keycodes, and every android keycode
+// to a linux keycode, in a shuffled order built at runtime, so the compiler can't fold constexpr lookups.
+// sendinput.cpp is included, not linked, so its static tables and linear lookups are visible.
+// Build on linux against AOSP headers and host libs:
+//   g++ -std=c++14 -O2 -I<aosp>/system/core/include -I../../include sendinput_keymap_bench.cpp -llog -lcutils -lutils -pthread
+// Run: ./a.out [rounds]
+
+#include "sendinput.cpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+static volatile int gSink = 0;
+
+// returns ns per lookup.
+template<typename WinToAndroid, typename AndroidToLinux>
+static double run(int rounds, const std::vector<int>& winCodes, const std::vector<int>& keyCodes,
+        WinToAndroid winToAndroid, AndroidToLinux androidToLinux) {
+    int sum = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        // WIN_SCANCODE_COUNT is added to an extended code.
+        for (int code : winCodes) {
+            sum += winToAndroid(code % WIN_SCANCODE_COUNT, code >= WIN_SCANCODE_COUNT);
+        }
+        for (int keyCode : keyCodes) {
+            sum += androidToLinux(keyCode);
+        }
+    }
+    gSink = sum;
+    const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    return ns / ((double)rounds * (winCodes.size() + keyCodes.size()));
+}
+
+int main(int argc, char** argv) {
+    const int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+
+    std::vector<int> winCodes(WIN_SCANCODE_COUNT * 2);
+    std::vector<int> keyCodes(ANDROID_KEYCODE_COUNT);
+    for (int n = 0; n < (int)winCodes.size(); n++) {
+        winCodes[n] = n;
+    }
+    for (int n = 0; n < (int)keyCodes.size(); n++) {
+        keyCodes[n] = n;
+    }
+    std::mt19937 random(1);
+    std::shuffle(winCodes.begin(), winCodes.end(), random);
+    std::shuffle(keyCodes.begin(), keyCodes.end(), random);
+
+    const double tableNs = run(rounds, winCodes, keyCodes,
+            [](int code, bool extended) { return (int)gKeyTables.winToAndroid[extended ? WIN_SCANCODE_COUNT + code : code]; },
+            [](int keyCode) { return (int)gKeyTables.androidToLinux[keyCode]; });
+    const double linearNs = run(rounds, winCodes, keyCodes,
+            [](int code, bool extended) { return (int)linearWinToAndroid(code, extended); },
+            [](int keyCode) { return (int)linearAndroidToLinux(keyCode); });
+
+    // both must agree on every entry, verifyKeyTables checks it at compile time too.
+    bool pass = true;
+    for (int code = 0; code < WIN_SCANCODE_COUNT; code++) {
+        pass = pass && win_scan_code_2_android_scan_code(code, false) == linearWinToAndroid(code, false)
+                && win_scan_code_2_android_scan_code(code, true) == linearWinToAndroid(code, true);
+    }
+    printf("%d rounds of %d lookups: table %.2f ns/lookup, linear scan %.2f ns/lookup, %.1fx\n",
+            rounds, WIN_SCANCODE_COUNT * 2 + ANDROID_KEYCODE_COUNT, tableNs, linearNs,
+            tableNs > 0 ? linearNs / tableNs : 0.0);
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+// Host benchmark of relative mouse: a 1000 Hz replay through send_relative, it isn't in Android.mk.
+// Moves of 3x2 are scaled by 1.5, with a click every 100 moves and a notch of wheel every 250 moves.
+// Then the same path as absolute positions, as RDP clients send it, must move the cursor as much.
+// A SOCK_SEQPACKET socket stands in for /dev/uinput, reader sums REL_X/REL_Y to check no fraction is lost.
+// Build on linux against AOSP headers and host libs:
+//   g++ -std=c++14 -O2 -I<aosp>/system/core/include -I../../include sendinput.cpp sendinput_relative_bench.cpp -llog -lcutils -lutils -pthread
+// Run: ./a.out [moves]
+
+#include "sendinput.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <chrono>
+
+using namespace android;
+
+struct Drain {
+    Drain() : writes(0), relX(0), relY(0), downs(0), ups(0), wheel(0), rightDown(false) {}
+
+    // read all pending messages of fd.
+    void operator()(int fd) {
+        struct input_event events[64];
+        ssize_t ret;
+        while ((ret = read(fd, events, sizeof(events))) > 0) {
+            writes++;
+            for (int n = 0; n < (int)(ret / sizeof(events[0])); n++) {
+                const struct input_event& ev = events[n];
+                if (ev.type == EV_REL && ev.code == REL_X) {
+                    relX += ev.value;
+                } else if (ev.type == EV_REL && ev.code == REL_Y) {
+                    relY += ev.value;
+                } else if (ev.type == EV_REL && ev.code == REL_WHEEL) {
+                    wheel += ev.value;
+                } else if (ev.type == EV_KEY && (ev.code == BTN_LEFT || ev.code == BTN_RIGHT || ev.code == BTN_MIDDLE)) {
+                    ev.value != 0 ? downs++ : ups++;
+                    if (ev.code == BTN_RIGHT) {
+                        rightDown = ev.value != 0;
+                    }
+                }
+            }
+        }
+    }
+
+    long writes;
+    long relX;
+    long relY;
+    long downs;
+    long ups;
+    long wheel;
+    bool rightDown;
+};
+
+static void setMouse(KosInput* input, uint32_t flags, int dx, int dy, uint32_t mouseData) {
+    memset(input, 0, sizeof(*input));
+    input->type = KOS_INPUT_MOUSE;
+    input->u.mi.flags = flags;
+    input->u.mi.dx = dx;
+    input->u.mi.dy = dy;
+    input->u.mi.mouse_data = mouseData;
+}
+
+int main(int argc, char** argv) {
+    const int moves = argc > 1 ? atoi(argv[1]) : 10000;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    const int sndbuf = 4 * 1024 * 1024;
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    NativeConnection* connection = NativeConnection::adopt(fds[1], 1, false);
+    connection->setRelativeScale(1500);
+
+    KosInput move, click[2], wheel;
+    setMouse(&move, MOUSEEVENTF_MOVE, 3, 2, 0);
+    setMouse(&click[0], MOUSEEVENTF_RIGHTDOWN, 0, 0, 0);
+    setMouse(&click[1], MOUSEEVENTF_RIGHTUP, 0, 0, 0);
+    setMouse(&wheel, MOUSEEVENTF_WHEEL, 0, 0, 120);
+
+    // every input is timed alone, the replay must fit 1000 us per input.
+    Drain drain;
+    double totalUs = 0;
+    double maxUs = 0;
+    int inputs = 0;
+    for (int at = 0; at < moves; at++) {
+        const auto start = std::chrono::steady_clock::now();
+        connection->send_relative(1, &move);
+        if (at % 100 == 0) {
+            connection->send_relative(2, click);
+            inputs += 2;
+        }
+        if (at % 250 == 0) {
+            connection->send_relative(1, &wheel);
+            inputs++;
+        }
+        const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        totalUs += us;
+        if (us > maxUs) {
+            maxUs = us;
+        }
+        inputs++;
+        if (at % 64 == 63) {
+            drain(fds[0]);
+        }
+    }
+    drain(fds[0]);
+
+    // 3 * 1.5 = 4.5, 2 * 1.5 = 3.0
+    const long expectX = (long)moves * 9 / 2;
+    const long expectY = (long)moves * 3;
+    printf("%d inputs in %.1f ms, %.2f us per input, max %.1f us, budget at 1000 Hz is 1000 us\n",
+            inputs, totalUs / 1000, totalUs / inputs, maxUs);
+    printf("REL_X %ld (expect %ld), REL_Y %ld (expect %ld), buttons %ld down %ld up, wheel %ld notches, %ld write()\n",
+            drain.relX, expectX, drain.relY, expectY, drain.downs, drain.ups, drain.wheel, drain.writes);
+    // remainder of an odd count is half a pixel, still held.
+    bool pass = labs(drain.relX - expectX) <= 1 && drain.relY == expectY;
+
+    // absolute positions of the same path, first one is only an origin.
+    connection->nativeClear();
+    drain = Drain();
+    KosInput absolute;
+    for (int at = 0; at <= moves; at++) {
+        setMouse(&absolute, MOUSEEVENTF_MOVE | MOUSEEVENTF_ABSOLUTE, 100 + 3 * at, 100 + 2 * at, 0);
+        connection->send_relative(1, &absolute);
+        if (at % 64 == 63) {
+            drain(fds[0]);
+        }
+    }
+    drain(fds[0]);
+    printf("absolute moves: REL_X %ld (expect %ld), REL_Y %ld (expect %ld)\n", drain.relX, expectX, drain.relY, expectY);
+    pass = pass && labs(drain.relX - expectX) <= 1 && drain.relY == expectY;
+
+    // a right button held when session ends must be lifted.
+    drain = Drain();
+    connection->send_relative(1, &click[0]);
+    connection->nativeClear();
+    drain(fds[0]);
+    printf("nativeClear after right down: right button is %s\n", drain.rightDown ? "still down" : "up");
+
+    pass = pass && !drain.rightDown;
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    delete connection;
+    close(fds[0]);
+    return pass ? 0 : 1;
+}
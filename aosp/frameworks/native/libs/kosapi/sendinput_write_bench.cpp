@@ -0,0 +1,89 @@
+// Host benchmark: write() calls and time per send_input, it isn't in Android.mk.
+// A SOCK_SEQPACKET socket stands in for /dev/uinput, one message is one write().
+// Build on linux against AOSP headers and host libs:
+//   g++ -std=c++14 -O2 -I<aosp>/system/core/include -I../../include sendinput.cpp sendinput_write_bench.cpp -llog -lcutils -lutils -pthread
+// Run: ./a.out [calls]
+
+#include "sendinput.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <chrono>
+
+using namespace android;
+
+struct Drain {
+    Drain() : writes(0), events(0) {}
+
+    // read all pending messages of fd.
+    void operator()(int fd) {
+        char buf[64 * sizeof(struct input_event)];
+        ssize_t ret;
+        while ((ret = read(fd, buf, sizeof(buf))) > 0) {
+            writes++;
+            events += ret / sizeof(struct input_event);
+        }
+    }
+
+    long writes;
+    long events;
+};
+
+static void setMouse(KosInput* input, uint32_t flags, int x, int y) {
+    memset(input, 0, sizeof(*input));
+    input->type = KOS_INPUT_MOUSE;
+    input->u.mi.flags = flags | MOUSEEVENTF_ABSOLUTE;
+    input->u.mi.dx = x;
+    input->u.mi.dy = y;
+}
+
+int main(int argc, char** argv) {
+    const int calls = argc > 1 ? atoi(argv[1]) : 100000;
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0) {
+        perror("socketpair");
+        return 1;
+    }
+    // large enough that writer never blocks between drains.
+    const int sndbuf = 4 * 1024 * 1024;
+    setsockopt(fds[1], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+    NativeConnection* connection = NativeConnection::adopt(fds[1], 1, false);
+    KosInput down, up;
+    setMouse(&down, MOUSEEVENTF_LEFTDOWN, 10, 20);
+    setMouse(&up, MOUSEEVENTF_LEFTUP, 10, 20);
+
+    // one down at an absolute position: ABS_X, ABS_Y, BTN_LEFT, SYN_REPORT.
+    Drain drain;
+    connection->send_input(1, &down);
+    drain(fds[0]);
+    printf("pointer down: %ld events in %ld write()\n", drain.events, drain.writes);
+
+    drain = Drain();
+    const auto start = std::chrono::steady_clock::now();
+    for (int at = 0; at < calls; at++) {
+        connection->send_input(1, at % 2 == 0 ? &up : &down);
+        if (at % 64 == 63) {
+            drain(fds[0]);
+        }
+    }
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    drain(fds[0]);
+    printf("alternating down/up: %.2f write() per send_input, %.2f events per send_input, %.3f us per send_input\n",
+            (double)drain.writes / calls, (double)drain.events / calls, us / calls);
+
+    drain = Drain();
+    connection->nativeClear();
+    drain(fds[0]);
+    printf("nativeClear: %ld events in %ld write()\n", drain.events, drain.writes);
+
+    delete connection;
+    close(fds[0]);
+    return 0;
+}
@@ -2,7 +2,11 @@
 
 #include <kosapi/sys2.h>
 #include <utils/Log.h>
+#include <utils/Timers.h>
 #include <map>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include <binder/IPCThreadState.h>
 #include <binder/ProcessState.h>
@@ -24,6 +28,9 @@ struct ClientAppInfo: public virtual android::RefBase
         , package(_package.empty()? "com.kos.launcher": _package)
         , did_touched(nullptr)
         , did_hover_moved(nullptr)
+        , did_motion_batch(nullptr)
+        , motion_batch_user(nullptr)
+        , frame_batching(false)
     {}
 
     virtual ~ClientAppInfo();
@@ -34,6 +41,9 @@ struct ClientAppInfo: public virtual android::RefBase
     android::sp<android::NativeInputEventReceiver> inputEventReceiver;
     fdid_sys2_touched did_touched;
     fdid_sys2_hover_moved did_hover_moved;
+    fdid_sys2_motion_batch did_motion_batch;
+    void* motion_batch_user;
+    bool frame_batching;
 };
 
 sp<IAppManager> get_appManager()
@@ -61,6 +71,35 @@ ClientAppInfo* get_appinfo()
     return app_internal.get();
 }
 
+// readClientChannel is a binder call, until it returns a channel, retry at most once per interval.
+static const nsecs_t kReadChannelIntervalNs = 100000000LL;
+static nsecs_t read_channel_time = 0;
+
+static NativeInputEventReceiver* ensure_receiver(ClientAppInfo* app)
+{
+    if (app->inputEventReceiver.get() != nullptr) {
+        return app->inputEventReceiver.get();
+    }
+    const nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    if (read_channel_time != 0 && now - read_channel_time < kReadChannelIntervalNs) {
+        return nullptr;
+    }
+    read_channel_time = now;
+
+    sp<InputChannel> clientChannel = app->appManager->readClientChannel(app->pid);
+    if (clientChannel.get() == nullptr) {
+        ALOGD("[sys2api.cpp] ensure_receiver, readClientChannel(%i) return null", app->pid);
+        return nullptr;
+    }
+    ALOGD("[sys2api.cpp] ensure_receiver, binder finished, fd: %i, name: %s", clientChannel->getFd(), clientChannel->getName().string());
+
+    app->inputEventReceiver = new NativeInputEventReceiver(clientChannel);
+    app->inputEventReceiver->initialize();
+    app->inputEventReceiver->set_did(app->did_touched, app->did_hover_moved);
+    app->inputEventReceiver->set_motion_batch_did(app->did_motion_batch, app->motion_batch_user, app->frame_batching);
+    return app->inputEventReceiver.get();
+}
+
 ClientAppInfo::~ClientAppInfo()
 {
     int pid = getpid();
@@ -119,8 +158,44 @@ NDK_EXPORT void kosSetSysDid(fdid_sys2_touched did_touched, fdid_sys2_hover_move
     }
 }
 
+NDK_EXPORT void kosSetMotionBatchDid(fdid_sys2_motion_batch did, void* user, bool frame_batching)
+{
+    int pid = getpid();
+    android::ClientAppInfo* app = android::get_appinfo();
+    if (app == nullptr || pid != app->pid) {
+         ALOGE("[sys2api.cpp] sys2_set_motion_batch_did, pid: %i, get_appinfo failed", pid);
+         return;
+    }
+    app->did_motion_batch = did;
+    app->motion_batch_user = user;
+    app->frame_batching = frame_batching;
+    if (app->inputEventReceiver.get() != nullptr) {
+        app->inputEventReceiver->set_motion_batch_did(did, user, frame_batching);
+    }
+}
+
+NDK_EXPORT bool kosConsumeBatchedInput(int64_t frame_time_ns)
+{
+    int pid = getpid();
+    android::ClientAppInfo* app = android::get_appinfo();
+    if (app == nullptr || pid != app->pid || app->inputEventReceiver.get() == nullptr) {
+        return false;
+    }
+    return app->inputEventReceiver->consumeBatchedInput(frame_time_ns);
+}
+
+static std::unique_ptr<std::thread> input_thread;
+static std::atomic<bool> input_thread_exit(false);
+// receiver that input thread blocks in, kosStopInputThread wakes it up. wake is sticky,
+// wake before pollOnce makes pollOnce return immediately.
+static std::mutex input_thread_mutex;
+static android::sp<android::NativeInputEventReceiver> input_thread_receiver;
+
 NDK_EXPORT void kosPumpEvent()
 {
+    if (input_thread.get() != nullptr) {
+        return;
+    }
     const int pid = getpid();
     android::ClientAppInfo* app = android::get_appinfo();
     if (app == nullptr || pid != app->pid) {
@@ -128,21 +203,71 @@ NDK_EXPORT void kosPumpEvent()
         return;
     }
 
-    if (app->inputEventReceiver.get() == nullptr) {
-        android::sp<android::InputChannel> clientChannel = app->appManager->readClientChannel(pid);
-        if (clientChannel.get() != nullptr) {
-            ALOGD("[sys2api.cpp] sys2_pump, binder finished, fd: %i, name: %s", clientChannel->getFd(), clientChannel->getName().string());
+    android::NativeInputEventReceiver* receiver = android::ensure_receiver(app);
+    if (receiver != nullptr) {
+        receiver->pollOnce();
+    }
+}
 
-            app->inputEventReceiver = new android::NativeInputEventReceiver(clientChannel);
-            app->inputEventReceiver->initialize();
-            app->inputEventReceiver->set_did(app->did_touched, app->did_hover_moved);
+NDK_EXPORT int kosGetInputFd()
+{
+    const int pid = getpid();
+    android::ClientAppInfo* app = android::get_appinfo();
+    if (app == nullptr || pid != app->pid) {
+        return -1;
+    }
+    android::NativeInputEventReceiver* receiver = android::ensure_receiver(app);
+    return receiver != nullptr? receiver->getFd(): -1;
+}
 
-        } else {
-            ALOGD("[sys2api.cpp] sys2_pump, readClientChannel(%i) return null", pid);
-            return;
+static void input_thread_loop(android::ClientAppInfo* app)
+{
+    while (!input_thread_exit) {
+        android::NativeInputEventReceiver* receiver = android::ensure_receiver(app);
+        if (receiver == nullptr) {
+            usleep(android::kReadChannelIntervalNs / 1000);
+            continue;
+        }
+        {
+            std::unique_lock<std::mutex> lock(input_thread_mutex);
+            if (input_thread_exit) {
+                break;
+            }
+            input_thread_receiver = receiver;
         }
+        receiver->pollOnce(-1);
     }
-    if (app->inputEventReceiver.get() != nullptr) {
-        app->inputEventReceiver->pollOnce();
+}
+
+NDK_EXPORT bool kosStartInputThread()
+{
+    if (input_thread.get() != nullptr) {
+        return true;
+    }
+    const int pid = getpid();
+    android::ClientAppInfo* app = android::get_appinfo();
+    if (app == nullptr || pid != app->pid) {
+        ALOGE("[sys2api.cpp] sys2_start_input_thread, get_appinfo(%i) is null", pid);
+        return false;
+    }
+    input_thread_exit = false;
+    input_thread.reset(new std::thread(input_thread_loop, app));
+    return true;
+}
+
+NDK_EXPORT void kosStopInputThread()
+{
+    if (input_thread.get() == nullptr) {
+        return;
     }
-}
\ No newline at end of file
+    {
+        std::unique_lock<std::mutex> lock(input_thread_mutex);
+        input_thread_exit = true;
+        if (input_thread_receiver.get() != nullptr) {
+            input_thread_receiver->wake();
+        }
+    }
+    input_thread->join();
+    input_thread.reset();
+    input_thread_receiver.clear();
+}
@@ -257,6 +257,98 @@ void TouchAffineTransformation::applyTo(float& x, float& y) const {
 }
 
 
+// --- PooledInputListener ---
+
+const size_t PooledInputListener::MAX_RETAINED_ARGS;
+
+PooledInputListener::PooledInputListener(const sp<InputListenerInterface>& innerListener) :
+        mInnerListener(innerListener), mQueuedCount(0), mAllocationCount(0) {
+}
+
+PooledInputListener::~PooledInputListener() {
+}
+
+template<typename T>
+void PooledInputListener::enqueue(ArgsType type, std::vector<T>& pool, const T* args) {
+    if (pool.size() == pool.capacity() || mQueue.size() == mQueue.capacity()) {
+        mAllocationCount++;
+    }
+    QueuedArgs queued;
+    queued.type = type;
+    queued.index = pool.size();
+    mQueue.push_back(queued);
+    pool.push_back(*args);
+    mQueuedCount++;
+}
+
+template<typename T>
+void PooledInputListener::trim(std::vector<T>& pool) {
+    if (pool.capacity() > MAX_RETAINED_ARGS) {
+        std::vector<T>().swap(pool);
+    } else {
+        // Keeps capacity.
+        pool.clear();
+    }
+}
+
+void PooledInputListener::notifyConfigurationChanged(
+        const NotifyConfigurationChangedArgs* args) {
+    enqueue(ARGS_CONFIGURATION_CHANGED, mConfigurationChangedArgs, args);
+}
+
+void PooledInputListener::notifyKey(const NotifyKeyArgs* args) {
+    enqueue(ARGS_KEY, mKeyArgs, args);
+}
+
+void PooledInputListener::notifyMotion(const NotifyMotionArgs* args) {
+    enqueue(ARGS_MOTION, mMotionArgs, args);
+}
+
+void PooledInputListener::notifySwitch(const NotifySwitchArgs* args) {
+    enqueue(ARGS_SWITCH, mSwitchArgs, args);
+}
+
+void PooledInputListener::notifyDeviceReset(const NotifyDeviceResetArgs* args) {
+    enqueue(ARGS_DEVICE_RESET, mDeviceResetArgs, args);
+}
+
+void PooledInputListener::flush() {
+    for (size_t i = 0; i < mQueue.size(); i++) {
+        const QueuedArgs& queued = mQueue[i];
+        switch (queued.type) {
+        case ARGS_CONFIGURATION_CHANGED:
+            mInnerListener->notifyConfigurationChanged(&mConfigurationChangedArgs[queued.index]);
+            break;
+        case ARGS_KEY:
+            mInnerListener->notifyKey(&mKeyArgs[queued.index]);
+            break;
+        case ARGS_MOTION:
+            mInnerListener->notifyMotion(&mMotionArgs[queued.index]);
+            break;
+        case ARGS_SWITCH:
+            mInnerListener->notifySwitch(&mSwitchArgs[queued.index]);
+            break;
+        case ARGS_DEVICE_RESET:
+            mInnerListener->notifyDeviceReset(&mDeviceResetArgs[queued.index]);
+            break;
+        }
+    }
+
+    trim(mQueue);
+    trim(mConfigurationChangedArgs);
+    trim(mKeyArgs);
+    trim(mMotionArgs);
+    trim(mSwitchArgs);
+    trim(mDeviceResetArgs);
+}
+
+void PooledInputListener::dump(String8& dump) {
+    dump.append(INDENT "Queued Listener:\n");
+    dump.appendFormat(INDENT2 "QueuedArgs: %" PRIu64 "\n", uint64_t(mQueuedCount));
+    dump.appendFormat(INDENT2 "PoolAllocations: %" PRIu64 "\n", uint64_t(mAllocationCount));
+}
+
+
 // --- InputReader ---
 
 InputReader::InputReader(const sp<EventHubInterface>& eventHub,
@@ -266,7 +358,8 @@ InputReader::InputReader(const sp<EventHubInterface>& eventHub,
         mGlobalMetaState(0), mGeneration(1),
         mDisableVirtualKeysTimeout(LLONG_MIN), mNextTimeout(LLONG_MAX),
         mConfigurationChangesToRefresh(0) {
-    mQueuedListener = new QueuedInputListener(listener);
+    mQueuedListener = new PooledInputListener(listener);
+    memset(&mProcessStats, 0, sizeof(mProcessStats));
 
     { // acquire lock
         AutoMutex _l(mLock);
@@ -311,7 +404,17 @@ void InputReader::loopOnce() {
         mReaderIsAliveCondition.broadcast();
 
         if (count) {
+            nsecs_t processStart = systemTime(SYSTEM_TIME_MONOTONIC);
             processEventsLocked(mEventBuffer, count);
+            nsecs_t processTime = systemTime(SYSTEM_TIME_MONOTONIC) - processStart;
+
+            mProcessStats.rawEventCount += count;
+            mProcessStats.batchCount++;
+            mProcessStats.processTime += processTime;
+            if (processTime > mProcessStats.maxBatchTime) {
+                mProcessStats.maxBatchTime = processTime;
+                mProcessStats.maxBatchRawEventCount = count;
+            }
         }
 
         if (mNextTimeout != LLONG_MAX) {
@@ -858,6 +961,24 @@ void InputReader::dump(String8& dump) {
             mConfig.pointerGestureMovementSpeedRatio);
     dump.appendFormat(INDENT3 "ZoomSpeedRatio: %0.1f\n",
             mConfig.pointerGestureZoomSpeedRatio);
+
+    dumpProcessStatsLocked(dump);
+    mQueuedListener->dump(dump);
+}
+
+void InputReader::dumpProcessStatsLocked(String8& dump) {
+    const ProcessStats& stats = mProcessStats;
+    dump.append(INDENT "Process Stats:\n");
+    dump.appendFormat(INDENT2 "RawEvents: %" PRIu64 ", Batches: %" PRIu64 "\n",
+            stats.rawEventCount, stats.batchCount);
+    if (stats.rawEventCount) {
+        dump.appendFormat(INDENT2 "AvgTimePerRawEvent: %" PRId64 "ns\n",
+                int64_t(stats.processTime / nsecs_t(stats.rawEventCount)));
+        dump.appendFormat(INDENT2 "AvgTimePerBatch: %" PRId64 "ns\n",
+                int64_t(stats.processTime / nsecs_t(stats.batchCount)));
+        dump.appendFormat(INDENT2 "MaxBatchTime: %" PRId64 "ns (%zu raw events)\n",
+                int64_t(stats.maxBatchTime), stats.maxBatchRawEventCount);
+    }
 }
 
 void InputReader::monitor() {
@@ -1256,6 +1377,49 @@ void InputDevice::notifyReset(nsecs_t when) {
 }
 
 
+// --- CachedProperty ---
+
+CachedProperty::CachedProperty(const char* name, const char* defaultValue) :
+        mName(name), mDefaultValue(defaultValue), mPropInfo(NULL),
+        mAreaSerial(0), mSerial(0), mRefreshed(false), mValueRead(false) {
+    strlcpy(mValue, defaultValue, sizeof(mValue));
+}
+
+bool CachedProperty::refresh() {
+    if (mPropInfo == NULL) {
+        // Serial of property area changes when a property is added, look it up again only then.
+        uint32_t areaSerial = __system_property_area_serial();
+        if (mRefreshed && areaSerial == mAreaSerial) {
+            return false;
+        }
+        mRefreshed = true;
+        mAreaSerial = areaSerial;
+        mPropInfo = __system_property_find(mName);
+        if (mPropInfo == NULL) {
+            return false;
+        }
+    }
+
+    uint32_t serial = __system_property_serial(mPropInfo);
+    if (mValueRead && serial == mSerial) {
+        return false;
+    }
+    // If it is set again while reading, serial is older than value, next refresh reads it again.
+    char value[PROPERTY_VALUE_MAX];
+    __system_property_read(mPropInfo, NULL, value);
+    mSerial = serial;
+    mValueRead = true;
+
+    // Same as property_get, empty value is default.
+    const char* newValue = value[0] ? value : mDefaultValue;
+    if (strcmp(newValue, mValue) == 0) {
+        return false;
+    }
+    strlcpy(mValue, newValue, sizeof(mValue));
+    return true;
+}
+
+
 // --- CursorButtonAccumulator ---
 
 CursorButtonAccumulator::CursorButtonAccumulator() {
@@ -2166,7 +2330,9 @@ void VibratorInputMapper::dump(String8& dump) {
 KeyboardInputMapper::KeyboardInputMapper(InputDevice* device,
         uint32_t source, int32_t keyboardType) :
         InputMapper(device), mSource(source),
-        mKeyboardType(keyboardType) {
+        mKeyboardType(keyboardType),
+        mKeyMouseStateProperty("sys.KeyMouse.mKeyMouseState", "off"),
+        mIdProperty("sys.ID.mID", "0") {
 }
 
 KeyboardInputMapper::~KeyboardInputMapper() {
@@ -2302,11 +2468,14 @@ void KeyboardInputMapper::processKey(nsecs_t when, bool down, int32_t scanCode,
             if (policyFlags & POLICY_FLAG_GESTURE) {
                 mDevice->cancelTouch(when);
             }
-	char mKeyMouseState[PROPERTY_VALUE_MAX] = {0};
-	property_get("sys.KeyMouse.mKeyMouseState", mKeyMouseState, "off");
-	char mID[PROPERTY_VALUE_MAX] = {0};
-	sprintf(mID,"%d",getDeviceId());
-	property_set("sys.ID.mID",mID);
+	mKeyMouseStateProperty.refresh();
+	const char* mKeyMouseState = mKeyMouseStateProperty.get();
+	mIdProperty.refresh();
+	if (atoi(mIdProperty.get()) != getDeviceId()) {
+		char mID[PROPERTY_VALUE_MAX] = {0};
+		sprintf(mID,"%d",getDeviceId());
+		property_set("sys.ID.mID",mID);
+	}
 
 	if (down) {
 	   if (keyCode == AKEYCODE_TV_KEYMOUSE_MODE_SWITCH) {
@@ -2999,7 +3168,12 @@ void RotaryEncoderInputMapper::sync(nsecs_t when) {
     mRotaryEncoderScrollAccumulator.finishSync();
 }
 
-KeyMouseInputMapper::KeyMouseInputMapper(InputDevice* device) : InputMapper(device) {
+// --- KeyMouseInputMapper ---
+
+KeyMouseInputMapper::KeyMouseInputMapper(InputDevice* device) :
+        InputMapper(device), mID(0),
+        mKeyMouseStateProperty("sys.KeyMouse.mKeyMouseState", "off"),
+        mIdProperty("sys.ID.mID", "0") {
 }
 
 KeyMouseInputMapper::~KeyMouseInputMapper() {
@@ -3022,6 +3196,7 @@ void KeyMouseInputMapper::configure(nsecs_t when,
 
     InputMapper::configure(when, config, changes);
 	mSource=AINPUT_SOURCE_MOUSE;
+	refreshProperties(true);
 }
 
 void KeyMouseInputMapper::reset(nsecs_t when) {
@@ -3036,13 +3211,6 @@ void KeyMouseInputMapper::process(const RawEvent* rawEvent) {
 
 	mCursorButtonAccumulator.process(rawEvent);
 
-	int mID;
-	char mgetDeviceID[PROPERTY_VALUE_MAX] = {0};
-	property_get("sys.ID.mID", mgetDeviceID,0);
-	mID=atoi(mgetDeviceID);
-
-	mPointerController = getPolicy()->obtainPointerController(mID);
-
 	if (rawEvent->type == EV_KEY && ((rawEvent->code== 28)||(rawEvent->code== 232))) {
 		mdeltax = 0;
 		mdeltay = 0;
@@ -3050,14 +3218,22 @@ void KeyMouseInputMapper::process(const RawEvent* rawEvent) {
 	}
 }
 
+// Properties are checked once per sync or configure, pointer controller is kept until sys.ID.mID changes.
+void KeyMouseInputMapper::refreshProperties(bool force) {
+    mKeyMouseStateProperty.refresh();
+    if (mIdProperty.refresh() || force || mPointerController == NULL) {
+        mID = atoi(mIdProperty.get());
+        mPointerController = getPolicy()->obtainPointerController(mID);
+    }
+}
+
 void KeyMouseInputMapper::sync(nsecs_t when) {
     int32_t lastButtonState = mButtonState;
     int32_t currentButtonState = mCursorButtonAccumulator.getButtonState();
     mButtonState = currentButtonState;
 
-    char mKeyLock[PROPERTY_VALUE_MAX] = {0};
-    memset(mKeyLock,0,5);
-    property_get("sys.KeyMouse.mKeyMouseState", mKeyLock, "off");
+    refreshProperties(false);
+    const char* mKeyLock = mKeyMouseStateProperty.get();
 
     bool wasDown = isPointerDown(lastButtonState);
     bool down = isPointerDown(currentButtonState);
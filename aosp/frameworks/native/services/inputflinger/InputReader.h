@@ -32,8 +32,14 @@
 #include <utils/String8.h>
 #include <utils/BitSet.h>
 
+#include <cutils/properties.h>
+
 #include <stddef.h>
 #include <unistd.h>
+#include <sys/system_properties.h>
+
+#include <atomic>
+#include <vector>
 
 // Maximum supported size of a vibration pattern.
 // Must be at least 2.
@@ -448,6 +454,66 @@ public:
 };
 
 
+/*
+ * Queues notifications until flush, same as QueuedInputListener, but doesn't allocate for each one.
+ * Args are copied into per-type pools that keep their capacity across flushes, so once pools have
+ * grown to the largest batch, the reader thread queues events without malloc/free.
+ * Notifications are delivered in the order they were queued.
+ */
+class PooledInputListener : public InputListenerInterface {
+protected:
+    virtual ~PooledInputListener();
+
+public:
+    explicit PooledInputListener(const sp<InputListenerInterface>& innerListener);
+
+    virtual void notifyConfigurationChanged(const NotifyConfigurationChangedArgs* args);
+    virtual void notifyKey(const NotifyKeyArgs* args);
+    virtual void notifyMotion(const NotifyMotionArgs* args);
+    virtual void notifySwitch(const NotifySwitchArgs* args);
+    virtual void notifyDeviceReset(const NotifyDeviceResetArgs* args);
+
+    void flush();
+
+    void dump(String8& dump);
+
+private:
+    enum ArgsType {
+        ARGS_CONFIGURATION_CHANGED,
+        ARGS_KEY,
+        ARGS_MOTION,
+        ARGS_SWITCH,
+        ARGS_DEVICE_RESET,
+    };
+
+    struct QueuedArgs {
+        ArgsType type;
+        size_t index; // in pool of type
+    };
+
+    // A burst may grow a pool far beyond usual batches, give memory back after it.
+    static const size_t MAX_RETAINED_ARGS = 64;
+
+    sp<InputListenerInterface> mInnerListener;
+
+    std::vector<QueuedArgs> mQueue;
+    std::vector<NotifyConfigurationChangedArgs> mConfigurationChangedArgs;
+    std::vector<NotifyKeyArgs> mKeyArgs;
+    std::vector<NotifyMotionArgs> mMotionArgs;
+    std::vector<NotifySwitchArgs> mSwitchArgs;
+    std::vector<NotifyDeviceResetArgs> mDeviceResetArgs;
+
+    // Written by reader thread, read by dump.
+    std::atomic<uint64_t> mQueuedCount;
+    std::atomic<uint64_t> mAllocationCount; // queued args that had to grow a pool
+
+    template<typename T>
+    void enqueue(ArgsType type, std::vector<T>& pool, const T* args);
+    template<typename T>
+    static void trim(std::vector<T>& pool);
+};
+
+
 /* The input reader reads raw event data from the event hub and processes it into input events
  * that it sends to the input listener.  Some functions of the input reader, such as early
  * event filtering in low power states, are controlled by a separate policy object.
@@ -526,7 +592,7 @@ private:
 
     sp<EventHubInterface> mEventHub;
     sp<InputReaderPolicyInterface> mPolicy;
-    sp<QueuedInputListener> mQueuedListener;
+    sp<PooledInputListener> mQueuedListener;
 
     InputReaderConfiguration mConfig;
 
@@ -572,6 +638,16 @@ private:
     uint32_t mConfigurationChangesToRefresh;
     void refreshConfigurationLocked(uint32_t changes);
 
+    // Cost of mappers on the device, raw events are processed in batches of getEvents.
+    struct ProcessStats {
+        uint64_t rawEventCount;
+        uint64_t batchCount;
+        nsecs_t processTime;
+        nsecs_t maxBatchTime;
+        size_t maxBatchRawEventCount;
+    } mProcessStats;
+    void dumpProcessStatsLocked(String8& dump);
+
     // state queries
     typedef int32_t (InputDevice::*GetStateFunc)(uint32_t sourceMask, int32_t code);
     int32_t getStateLocked(int32_t deviceId, uint32_t sourceMask, int32_t code,
@@ -691,6 +767,28 @@ private:
 };
 
 
+/* Keeps a copy of a system property, reads it again only when its serial changes.
+ * Checking the serial is an atomic load, much cheaper than property_get on every event. */
+class CachedProperty {
+public:
+    CachedProperty(const char* name, const char* defaultValue);
+
+    // Return true if value changed.
+    bool refresh();
+    const char* get() const { return mValue; }
+
+private:
+    const char* mName;
+    const char* mDefaultValue;
+    const prop_info* mPropInfo; // NULL until property is added
+    uint32_t mAreaSerial;
+    uint32_t mSerial;
+    bool mRefreshed;
+    bool mValueRead;
+    char mValue[PROPERTY_VALUE_MAX];
+};
+
+
 /* Keeps track of the state of mouse or touch pad buttons. */
 class CursorButtonAccumulator {
 public:
@@ -1167,6 +1265,10 @@ private:
     LedState mNumLockLedState;
     LedState mScrollLockLedState;
 
+    // Shared with KeyMouseInputMapper.
+    CachedProperty mKeyMouseStateProperty;
+    CachedProperty mIdProperty;
+
     // Immutable configuration parameters.
     struct Parameters {
         bool hasAssociatedDisplay;
@@ -1301,6 +1403,12 @@ private:
     int32_t mButtonState;
     nsecs_t mDownTime;
     int mID;
+
+    // Written by KeyboardInputMapper.
+    CachedProperty mKeyMouseStateProperty;
+    CachedProperty mIdProperty;
+
+    void refreshProperties(bool force);
     void sync(nsecs_t when);
 };
 
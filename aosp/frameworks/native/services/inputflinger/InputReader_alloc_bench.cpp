@@ -0,0 +1,125 @@
+// Device benchmark: heap allocations of queuing reader notifications, it isn't in any Android.mk.
+// The same notification stream goes through QueuedInputListener and PooledInputListener, every loop is
+// flushed like InputReader::loopOnce does. Global operator new is replaced to count allocations, the
+// inner listener checks every notification arrives once and in order.
+// Stream: 240 loops per second for 10 s, 1-5 motions per loop, a key and a switch every 7 loops,
+// a reset and a configuration change every 100 loops, and a burst of 200 motions at loop 1000.
+// Build as an executable with LOCAL_SHARED_LIBRARIES := libinputflinger libinput libutils, run on device:
+//   adb shell /data/local/tmp/inputreader_alloc_bench [loops]
+
+#include "InputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+using namespace android;
+
+static size_t gAllocations = 0;
+
+void* operator new(size_t size) {
+    gAllocations++;
+    void* p = malloc(size);
+    if (p == NULL) {
+        abort();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+class Recorder : public InputListenerInterface {
+public:
+    Recorder() : mCount(0), mLastTime(-1), mOrdered(true) {}
+
+    virtual void notifyConfigurationChanged(const NotifyConfigurationChangedArgs* args) {
+        check(args->eventTime);
+    }
+    virtual void notifyKey(const NotifyKeyArgs* args) {
+        check(args->eventTime);
+    }
+    virtual void notifyMotion(const NotifyMotionArgs* args) {
+        check(args->eventTime);
+    }
+    virtual void notifySwitch(const NotifySwitchArgs* args) {
+        check(args->eventTime);
+    }
+    virtual void notifyDeviceReset(const NotifyDeviceResetArgs* args) {
+        check(args->eventTime);
+    }
+
+    size_t count() const { return mCount; }
+    bool ordered() const { return mOrdered; }
+
+private:
+    // eventTime of the stream increases by 1 every notification.
+    void check(nsecs_t when) {
+        if (when != mLastTime + 1) {
+            mOrdered = false;
+        }
+        mLastTime = when;
+        mCount++;
+    }
+
+    size_t mCount;
+    nsecs_t mLastTime;
+    bool mOrdered;
+};
+
+template<typename Listener>
+static size_t replay(Listener& listener, int loops) {
+    PointerProperties properties;
+    properties.clear();
+    PointerCoords coords;
+    coords.clear();
+    coords.setAxisValue(AMOTION_EVENT_AXIS_X, 100);
+    coords.setAxisValue(AMOTION_EVENT_AXIS_Y, 200);
+
+    nsecs_t when = 0;
+    for (int loop = 0; loop < loops; loop++) {
+        const int motions = 1 + loop % 5 + (loop == 1000 ? 200 : 0);
+        for (int n = 0; n < motions; n++) {
+            NotifyMotionArgs args(when++, 1, AINPUT_SOURCE_MOUSE, 0,
+                    AMOTION_EVENT_ACTION_HOVER_MOVE, 0, 0, 0, 0, AMOTION_EVENT_EDGE_FLAG_NONE,
+                    0, 1, &properties, &coords, 1, 1, 0);
+            listener.notifyMotion(&args);
+        }
+        if (loop % 7 == 0) {
+            const nsecs_t keyTime = when++;
+            NotifyKeyArgs key(keyTime, 2, AINPUT_SOURCE_KEYBOARD, 0,
+                    AKEY_EVENT_ACTION_DOWN, 0, AKEYCODE_A, 30, 0, keyTime);
+            listener.notifyKey(&key);
+            NotifySwitchArgs sw(when++, 0, 0, 1);
+            listener.notifySwitch(&sw);
+        }
+        if (loop % 100 == 0) {
+            NotifyDeviceResetArgs reset(when++, 1);
+            listener.notifyDeviceReset(&reset);
+            NotifyConfigurationChangedArgs changed(when++);
+            listener.notifyConfigurationChanged(&changed);
+        }
+        listener.flush();
+    }
+    return when;
+}
+
+template<typename Listener>
+static void run(const char* label, int loops) {
+    sp<Recorder> recorder = new Recorder;
+    sp<Listener> listener = new Listener(recorder);
+    const size_t before = gAllocations;
+    const size_t notifications = replay(*listener.get(), loops);
+    const size_t allocations = gAllocations - before;
+    printf("%s: %zu notifications, %zu allocations (%.3f per notification), %s\n", label,
+            notifications, allocations, notifications > 0 ? (double)allocations / notifications : 0.0,
+            recorder->count() == notifications && recorder->ordered() ? "delivered in order" : "LOST OR REORDERED");
+}
+
+int main(int argc, char** argv) {
+    const int loops = argc > 1 ? atoi(argv[1]) : 240 * 10;
+    run<QueuedInputListener>("QueuedInputListener", loops);
+    run<PooledInputListener>("PooledInputListener", loops);
+    return 0;
+}
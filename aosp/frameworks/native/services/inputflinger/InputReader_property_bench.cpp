@@ -0,0 +1,101 @@
+// Device benchmark: cost per raw event of reading KeyMouse properties, it isn't in any Android.mk.
+// A stream of mouse frames (ABS_X, ABS_Y, BTN_LEFT, SYN_REPORT) is replayed twice:
+//   property_get: sys.ID.mID every event and sys.KeyMouse.mKeyMouseState every sync, as KeyMouseInputMapper did.
+//   CachedProperty: both refreshed once per sync, as it does now.
+// Then the same with debug.kos.bench.prop set to a new value every 1000 events, so re-reads are counted too.
+// Build as an executable with LOCAL_SHARED_LIBRARIES := libinputflinger libcutils libutils, run on device as shell:
+//   adb shell /data/local/tmp/inputreader_property_bench [events]
+
+#include "InputReader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <linux/input.h>
+#include <cutils/properties.h>
+#include <utils/Timers.h>
+
+using namespace android;
+
+static const int kEventsPerSync = 4;
+static const int kChangeInterval = 1000;
+
+// codes of one mouse frame, value isn't used.
+static const int32_t kFrameTypes[kEventsPerSync] = {EV_ABS, EV_ABS, EV_KEY, EV_SYN};
+
+static volatile int gSink = 0;
+
+static void setBenchProp(int value) {
+    char str[PROPERTY_VALUE_MAX];
+    snprintf(str, sizeof(str), "%d", value);
+    property_set("debug.kos.bench.prop", str);
+}
+
+// timed in segments of kChangeInterval events, property_set between them isn't counted.
+static nsecs_t runPropertyGet(int events, const char* idName, bool changing) {
+    char value[PROPERTY_VALUE_MAX];
+    nsecs_t used = 0;
+    for (int segment = 0; segment < events; segment += kChangeInterval) {
+        if (changing) {
+            setBenchProp(segment + 1);
+        }
+        const int end = segment + kChangeInterval < events ? segment + kChangeInterval : events;
+        const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int at = segment; at < end; at++) {
+            property_get(idName, value, "0");
+            gSink += atoi(value);
+            if (kFrameTypes[at % kEventsPerSync] == EV_SYN) {
+                property_get("sys.KeyMouse.mKeyMouseState", value, "off");
+                gSink += value[0];
+            }
+        }
+        used += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+    return used;
+}
+
+static nsecs_t runCachedProperty(int events, const char* idName, bool changing, int* outChanges) {
+    CachedProperty keyMouseState("sys.KeyMouse.mKeyMouseState", "off");
+    CachedProperty id(idName, "0");
+    nsecs_t used = 0;
+    *outChanges = 0;
+    for (int segment = 0; segment < events; segment += kChangeInterval) {
+        if (changing) {
+            setBenchProp(segment + 1);
+        }
+        const int end = segment + kChangeInterval < events ? segment + kChangeInterval : events;
+        const nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int at = segment; at < end; at++) {
+            if (kFrameTypes[at % kEventsPerSync] == EV_SYN) {
+                keyMouseState.refresh();
+                if (id.refresh()) {
+                    (*outChanges)++;
+                }
+                gSink += atoi(id.get()) + keyMouseState.get()[0];
+            }
+        }
+        used += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    }
+    return used;
+}
+
+static void report(const char* label, int events, nsecs_t getUsed, nsecs_t cachedUsed) {
+    printf("%s: property_get %.1f ns/event, CachedProperty %.1f ns/event, %.1fx\n", label,
+            (double)getUsed / events, (double)cachedUsed / events,
+            cachedUsed > 0 ? (double)getUsed / cachedUsed : 0.0);
+}
+
+int main(int argc, char** argv) {
+    const int events = argc > 1 ? atoi(argv[1]) : 1000000;
+    int changes;
+
+    const nsecs_t stableGet = runPropertyGet(events, "sys.ID.mID", false);
+    const nsecs_t stableCached = runCachedProperty(events, "sys.ID.mID", false, &changes);
+    report("unchanged", events, stableGet, stableCached);
+
+    setBenchProp(0);
+    const nsecs_t changingGet = runPropertyGet(events, "debug.kos.bench.prop", true);
+    const nsecs_t changingCached = runCachedProperty(events, "debug.kos.bench.prop", true, &changes);
+    report("changed every 1000 events", events, changingGet, changingCached);
+    printf("CachedProperty saw %d of %d changes\n", changes, (events + kChangeInterval - 1) / kChangeInterval);
+    return 0;
+}
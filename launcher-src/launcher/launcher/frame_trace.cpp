@@ -0,0 +1,218 @@
+#define GETTEXT_DOMAIN "launcher-lib"
+
+#include "global.hpp"
+#include "frame_trace.hpp"
+#include "perf_counters.hpp"
+
+#include <stdio.h>
+#include <mutex>
+
+#include <SDL_log.h>
+
+namespace frame_trace {
+
+// how many kos traces are searched for the dequeued frame. rose may discard some frames, but not too many.
+static const int max_match_distance = 8;
+static const int max_kos_traces = 64;
+
+ttracer::ttracer()
+	: last_kos_seq_(0)
+	, sending_(false)
+	, written_bytes_(0)
+{}
+
+void ttracer::reset()
+{
+	kos_traces_.clear();
+	sending_ = false;
+	current_ = tframe();
+	inflight_.clear();
+	written_bytes_ = 0;
+	// keep last_kos_seq_, frames before this connection must not match.
+}
+
+void ttracer::fetch_kos_traces()
+{
+	KosFrameTrace traces[16];
+	int count;
+	do {
+		count = kosGetFrameTraces(last_kos_seq_, traces, sizeof(traces) / sizeof(traces[0]));
+		for (int at = 0; at < count; at ++) {
+			const KosFrameTrace& trace = traces[at];
+			if (trace.input_seq != 0) {
+				// every encoded frame is here, even if rose discards it later.
+				perf_counters::record(perf_counters::histogram_input_photon_us, trace.output_usec - trace.input_usec);
+			}
+			kos_traces_.push_back(trace);
+			last_kos_seq_ = trace.seq;
+		}
+	} while (count == sizeof(traces) / sizeof(traces[0]));
+
+	while ((int)kos_traces_.size() > max_kos_traces) {
+		kos_traces_.pop_front();
+	}
+}
+
+void ttracer::did_dequeue(int size)
+{
+	current_ = tframe();
+	current_.size = size;
+	current_.dequeue_us = perf_counters::now_us();
+	sending_ = true;
+
+	fetch_kos_traces();
+	// frames are fifo from encoder to encoded_images, search by size from the oldest.
+	int at = 0;
+	for (std::deque<KosFrameTrace>::const_iterator it = kos_traces_.begin(); it != kos_traces_.end() && at < max_match_distance; ++ it, at ++) {
+		if ((int)it->size == size) {
+			const KosFrameTrace& trace = *it;
+			current_.seq = trace.seq;
+			current_.pts_us = trace.pts_usec;
+			current_.output_us = trace.output_usec;
+			current_.delivered_us = trace.delivered_usec;
+			kos_traces_.erase(kos_traces_.begin(), it + 1);
+			return;
+		}
+	}
+	perf_counters::add(perf_counters::counter_trace_unmatched);
+}
+
+void ttracer::did_write_layer(int bytes)
+{
+	if (bytes <= 0) {
+		return;
+	}
+	if (sending_ && current_.serialized_us == 0) {
+		current_.serialized_us = perf_counters::now_us();
+	}
+	written_bytes_ += bytes;
+}
+
+void ttracer::did_send()
+{
+	if (!sending_) {
+		return;
+	}
+	sending_ = false;
+	if (current_.serialized_us == 0) {
+		// nothing written, for example gfx channel isn't ready.
+		return;
+	}
+	current_.end_offset = written_bytes_;
+	inflight_.push_back(current_);
+}
+
+void ttracer::check_socket(int64_t pending_bytes)
+{
+	const int64_t drained = written_bytes_ - pending_bytes;
+	while (!inflight_.empty() && inflight_.front().end_offset <= drained) {
+		tframe& frame = inflight_.front();
+		frame.socket_us = perf_counters::now_us();
+		finish(frame);
+		inflight_.pop_front();
+	}
+}
+
+static std::mutex chrome_trace_mutex;
+static FILE* chrome_trace_fp = nullptr;
+static bool chrome_trace_first_event = true;
+
+static void write_chrome_event(const char* name, int tid, int64_t start_us, int64_t end_us, const tframe& frame)
+{
+	if (start_us == 0 || end_us < start_us) {
+		return;
+	}
+	fprintf(chrome_trace_fp, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%lld,\"dur\":%lld,\"args\":{\"seq\":%u,\"size\":%i}}",
+		chrome_trace_first_event? "": ",\n", name, tid, (long long)start_us, (long long)(end_us - start_us), frame.seq, frame.size);
+	chrome_trace_first_event = false;
+}
+
+void ttracer::finish(tframe& frame)
+{
+	using namespace perf_counters;
+
+	// delivered_us maybe 0, if rdpd_slice dequeued this frame before fdid_gui2_screen_captured returned.
+	const int64_t enqueued_us = frame.delivered_us != 0? frame.delivered_us: frame.output_us;
+	if (frame.seq != 0) {
+		record(histogram_encode_us, frame.output_us - frame.pts_us);
+		if (frame.delivered_us != 0) {
+			record(histogram_deliver_us, frame.delivered_us - frame.output_us);
+		}
+		record(histogram_queue_us, frame.dequeue_us - enqueued_us);
+		record(histogram_frame_latency_us, frame.socket_us - frame.pts_us);
+	}
+	record(histogram_serialize_us, frame.serialized_us - frame.dequeue_us);
+	record(histogram_socket_us, frame.socket_us - frame.serialized_us);
+
+	std::lock_guard<std::mutex> lock(chrome_trace_mutex);
+	if (chrome_trace_fp == nullptr) {
+		return;
+	}
+	if (frame.seq != 0) {
+		write_chrome_event("encode", 1, frame.pts_us, frame.output_us, frame);
+		write_chrome_event("deliver", 2, frame.output_us, frame.delivered_us, frame);
+		write_chrome_event("queue", 3, enqueued_us, frame.dequeue_us, frame);
+	}
+	write_chrome_event("serialize", 4, frame.dequeue_us, frame.serialized_us, frame);
+	write_chrome_event("socket", 5, frame.serialized_us, frame.socket_us, frame);
+}
+
+bool start_chrome_trace(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(chrome_trace_mutex);
+	if (chrome_trace_fp != nullptr) {
+		return false;
+	}
+	chrome_trace_fp = fopen(path.c_str(), "w");
+	if (chrome_trace_fp == nullptr) {
+		SDL_Log("frame_trace::start_chrome_trace, can not open %s", path.c_str());
+		return false;
+	}
+	fputs("[\n", chrome_trace_fp);
+	chrome_trace_first_event = true;
+
+	const char* stages[] = {"encode", "deliver", "queue", "serialize", "socket"};
+	for (int at = 0; at < (int)(sizeof(stages) / sizeof(stages[0])); at ++) {
+		fprintf(chrome_trace_fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"%s\"}}",
+			chrome_trace_first_event? "": ",\n", at + 1, stages[at]);
+		chrome_trace_first_event = false;
+	}
+	SDL_Log("frame_trace::start_chrome_trace, %s", path.c_str());
+	return true;
+}
+
+void stop_chrome_trace()
+{
+	std::lock_guard<std::mutex> lock(chrome_trace_mutex);
+	if (chrome_trace_fp == nullptr) {
+		return;
+	}
+	fputs("\n]\n", chrome_trace_fp);
+	fclose(chrome_trace_fp);
+	chrome_trace_fp = nullptr;
+	SDL_Log("frame_trace::stop_chrome_trace");
+}
+
+bool chrome_trace_enabled()
+{
+	std::lock_guard<std::mutex> lock(chrome_trace_mutex);
+	return chrome_trace_fp != nullptr;
+}
+
+std::string handle_trace_command(const std::string& args)
+{
+	if (args.compare(0, 6, "start ") == 0 && args.size() > 6) {
+		const std::string path = perf_counters::output_path(args.substr(6));
+		if (path.empty()) {
+			return "{\"error\":\"invalid file name\"}";
+		}
+		const bool ok = start_chrome_trace(path);
+		return ok? "{\"trace\":\"started\"}": "{\"error\":\"trace is running, or can not open file\"}";
+	} else if (args == "stop") {
+		stop_chrome_trace();
+		return "{\"trace\":\"stopped\"}";
+	}
+	return "{\"error\":\"usage: trace start <name> | trace stop\"}";
+}
+
+}
@@ -0,0 +1,88 @@
+#ifndef FRAME_TRACE_HPP_INCLUDED
+#define FRAME_TRACE_HPP_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <deque>
+
+#include <kosapi/gui.h>
+
+// Follow every encoded frame from capture to socket, stage by stage.
+//   encode:    pts --> encoder output			(kosGetFrameTraces)
+//   deliver:   encoder output --> enqueued to encoded_images
+//   queue:     enqueued --> dequeued in rdpd_slice
+//   serialize: dequeued --> first byte written to write_buf by did_rose_write_layer
+//   socket:    first byte written --> last byte of this frame leaves write_buf
+// Every stage is recorded into perf_counters' histograms, and into chrome trace file when it is enabled.
+// Besides, injected input --> first frame encoded after it is recorded into histogram_input_photon_us.
+namespace frame_trace {
+
+struct tframe
+{
+	tframe()
+		: seq(0)
+		, size(0)
+		, pts_us(0)
+		, output_us(0)
+		, delivered_us(0)
+		, dequeue_us(0)
+		, serialized_us(0)
+		, socket_us(0)
+		, end_offset(0)
+	{}
+
+	uint32_t seq; // 0: can not find it in kosGetFrameTraces.
+	int size;
+	int64_t pts_us;
+	int64_t output_us;
+	int64_t delivered_us;
+	int64_t dequeue_us;
+	int64_t serialized_us;
+	int64_t socket_us;
+	int64_t end_offset; // offset of this frame's last byte in write stream.
+};
+
+// live in rdpd thread.
+class ttracer
+{
+public:
+	ttracer();
+
+	// new connection, write stream restart from 0.
+	void reset();
+
+	// rdpd_slice dequeued one frame from encoded_images.
+	void did_dequeue(int size);
+	// did_rose_write_layer wrote bytes to write_buf.
+	void did_write_layer(int bytes);
+	// rose_did_update_peer_send of dequeued frame returned.
+	void did_send();
+	// pending_bytes is write_buf->total_size(). frames whose bytes all have left write_buf are finished.
+	void check_socket(int64_t pending_bytes);
+
+private:
+	void fetch_kos_traces();
+	void finish(tframe& frame);
+
+private:
+	std::deque<KosFrameTrace> kos_traces_;
+	uint32_t last_kos_seq_;
+
+	bool sending_;
+	tframe current_;
+	std::deque<tframe> inflight_;
+	int64_t written_bytes_;
+};
+
+// chrome trace(json array format, open it in chrome://tracing or perfetto) can be enabled at runtime,
+// for example by perf_counters::tserver's "trace start <name>", file is perf_counters::output_path(name).
+bool start_chrome_trace(const std::string& path);
+void stop_chrome_trace();
+bool chrome_trace_enabled();
+
+// command handler of perf_counters::tserver: "start <name>" or "stop".
+std::string handle_trace_command(const std::string& args);
+
+}
+
+#endif
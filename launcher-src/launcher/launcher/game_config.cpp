@@ -55,4 +55,32 @@ void set_bleperipheral(bool value)
 	}
 }
 
+bool relative_mouse()
+{
+	return preferences::get_bool("relative_mouse", false);
+}
+
+void set_relative_mouse(bool value)
+{
+	if (relative_mouse() != value) {
+		preferences::set_bool("relative_mouse", value);
+		preferences::write_preferences();
+	}
+}
+
+int relative_mouse_scale()
+{
+	const int value = preferences::get_int("relative_mouse_scale", 1000);
+	return value > 0? value: 1000;
+}
+
+void set_relative_mouse_scale(int value)
+{
+	VALIDATE(value > 0, null_str);
+	if (relative_mouse_scale() != value) {
+		preferences::set_int("relative_mouse_scale", value);
+		preferences::write_preferences();
+	}
+}
+
 }
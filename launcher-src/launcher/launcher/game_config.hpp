@@ -24,6 +24,13 @@ std::string sn();
 void set_sn(const std::string& value);
 bool bleperipheral();
 void set_bleperipheral(bool value);
+// global, every connection after it is set injects mouse by relative device(kosSetMouseMode).
+// client's absolute moves become deltas.
+bool relative_mouse();
+void set_relative_mouse(bool value);
+// relative moves are multiplied by it / 1000.
+int relative_mouse_scale();
+void set_relative_mouse_scale(int value);
 
 }
 
@@ -22,6 +22,7 @@
 
 #include "game_config.hpp"
 #include "pble2.hpp"
+#include "perf_counters.hpp"
 #include "ResponseCode.h"
 
 extern uint32_t ReceivingInterfaceAddr;
@@ -172,7 +173,7 @@ void game_instance::app_load_settings_config(const config& cfg)
 	kosGetVersion(libkosapi_ver, sizeof(libkosapi_ver));
 	game_config::kosapi_ver = version_info(libkosapi_ver);
 	VALIDATE(game_config::kosapi_ver.is_rose_recommended(), std::string("Error version: ") + game_config::kosapi_ver.str(true));
-	const version_info min_libkosapi_ver("1.0.3-20210422");
+	const version_info min_libkosapi_ver("1.0.6-20261019");
 	if (game_config::kosapi_ver < min_libkosapi_ver) {
 		std::stringstream err;
 		err << "libkospai's version(" << game_config::kosapi_ver.str(true) << ") must >= " << min_libkosapi_ver.str(true);
@@ -272,7 +273,7 @@ bool game_instance::app_update_ip(const uint32_t ipv4, const int prefixlen, cons
     char* msg_ptr = msg.get();
 
 	sprintf(msg_ptr, "launcher netid %s", iface.c_str());
-    int code = kosNetSendMsg(msg_ptr, result, maxBytes);
+    int code = perf_counters::net_send_msg(msg_ptr, result, maxBytes);
 	if (game_config::os == os_windows) {
 		SDL_snprintf(result, maxBytes, "%s 100", iface.c_str());
 	}
@@ -288,7 +289,7 @@ bool game_instance::app_update_ip(const uint32_t ipv4, const int prefixlen, cons
 
 	// interface getcfg eth0
 	sprintf(msg_ptr, "interface getcfg %s", iface.c_str());
-    kosNetSendMsg(msg_ptr, result, maxBytes);
+    perf_counters::net_send_msg(msg_ptr, result, maxBytes);
 	if (game_config::os == os_windows) {
 		// 36:56:fb:9f:f8:a2 192.168.1.108 24 up broadcast running multicast
 		// 00:00:00:00:00:00 0.0.0.0 0 down
@@ -301,29 +302,29 @@ bool game_instance::app_update_ip(const uint32_t ipv4, const int prefixlen, cons
         originalIpv4 = utils::to_ipv4(vstr[1]);
     }
 
-    kosNetSendMsg("launcher broadcast disable", result, maxBytes);
+    perf_counters::net_send_msg("launcher broadcast disable", result, maxBytes);
 	// interface clearaddrs eth0
 	sprintf(msg_ptr, "interface clearaddrs %s", iface.c_str());
-    kosNetSendMsg(msg_ptr, result, maxBytes);
+    perf_counters::net_send_msg(msg_ptr, result, maxBytes);
 
 	did_net_state_changed(nullptr, false, originalIpv4);
 
 	// interface setcfg eth0 192.168.1.116 24 multicast up broadcast running
 	sprintf(msg_ptr, "interface setcfg %s %s %i multicast up broadcast running", iface.c_str(), ipaddr.ToString().c_str(), prefixlen);
-    kosNetSendMsg(msg_ptr, result, maxBytes);
+    perf_counters::net_send_msg(msg_ptr, result, maxBytes);
 
 	// network route add 100 eth0 192.168.1.0/24
 	uint32_t widecard_gateway = calculate_widecard_ip(_gateway, prefixlen);
 	net::IPAddress widecard_gateway2((const uint8_t*)&widecard_gateway, 4);
     sprintf(msg_ptr, "network route add %i %s %s/%i", netId, iface.c_str(), widecard_gateway2.ToString().c_str(), prefixlen);
-    kosNetSendMsg(msg_ptr, result, maxBytes);
+    perf_counters::net_send_msg(msg_ptr, result, maxBytes);
 
 	// network route add 100 eth0 0.0.0.0/0 192.168.1.1
     sprintf(msg_ptr, "network route add %i %s 0.0.0.0/0 %s", netId, iface.c_str(), gateway.ToString().c_str());
-    kosNetSendMsg(msg_ptr, result, maxBytes);
+    perf_counters::net_send_msg(msg_ptr, result, maxBytes);
 
 	// network default set 100
-    kosNetSendMsg("launcher broadcast enable", result, maxBytes);
+    perf_counters::net_send_msg("launcher broadcast enable", result, maxBytes);
 
 	return true;
 }
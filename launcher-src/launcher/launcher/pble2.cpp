@@ -34,6 +34,7 @@ using namespace std::placeholders;
 
 #include "base_instance.hpp"
 #include <kosapi/net.h>
+#include "perf_counters.hpp"
 
 const char* tpble2::uuid_my_service = "fd00";
 const char* tpble2::uuid_write_characteristic = "fd01";
@@ -46,7 +47,7 @@ uint32_t getipv4_prefixlen(const std::string& iface, int* prefixlen)
 	char msg[128];
 
 	sprintf(msg, "interface getcfg %s", iface.c_str());
-    kosNetSendMsg(msg, result, maxBytes);
+    perf_counters::net_send_msg(msg, result, maxBytes);
 	if (game_config::os == os_windows) {
 		// 36:56:fb:9f:f8:a2 192.168.1.108 24 up broadcast running multicast
 		// 00:00:00:00:00:00 0.0.0.0 0 down
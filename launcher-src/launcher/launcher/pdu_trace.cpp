@@ -0,0 +1,158 @@
+#define GETTEXT_DOMAIN "launcher-lib"
+
+#include "global.hpp"
+#include "pdu_trace.hpp"
+#include "perf_counters.hpp"
+
+#include <stdio.h>
+#include <string.h>
+#include <mutex>
+#include <atomic>
+
+#include <SDL_log.h>
+#include <SDL_endian.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+namespace pdu_trace {
+
+static const char magic[] = {'L', 'P', 'D', 'U'};
+static const uint32_t version = 1;
+
+static std::mutex record_mutex;
+static FILE* record_fp = nullptr;
+// OnRdpRequest checks it without locking record_mutex.
+static std::atomic<bool> record_enabled(false);
+static int64_t record_start_us = 0;
+
+static void write_u32(FILE* fp, uint32_t value)
+{
+	value = SDL_SwapLE32(value);
+	fwrite(&value, 1, 4, fp);
+}
+
+static void write_u64(FILE* fp, uint64_t value)
+{
+	value = SDL_SwapLE64(value);
+	fwrite(&value, 1, 8, fp);
+}
+
+static bool read_u32(FILE* fp, uint32_t* value)
+{
+	if (fread(value, 1, 4, fp) != 4) {
+		return false;
+	}
+	*value = SDL_SwapLE32(*value);
+	return true;
+}
+
+static bool read_u64(FILE* fp, uint64_t* value)
+{
+	if (fread(value, 1, 8, fp) != 8) {
+		return false;
+	}
+	*value = SDL_SwapLE64(*value);
+	return true;
+}
+
+bool start_record(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(record_mutex);
+	if (record_fp != nullptr) {
+		return false;
+	}
+#ifndef _WIN32
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	record_fp = fd >= 0? fdopen(fd, "wb"): nullptr;
+#else
+	record_fp = fopen(path.c_str(), "wb");
+#endif
+	if (record_fp == nullptr) {
+		SDL_Log("pdu_trace::start_record, can not open %s", path.c_str());
+		return false;
+	}
+	fwrite(magic, 1, sizeof(magic), record_fp);
+	write_u32(record_fp, version);
+	record_start_us = 0;
+	record_enabled = true;
+	SDL_Log("pdu_trace::start_record, %s", path.c_str());
+	return true;
+}
+
+void stop_record()
+{
+	std::lock_guard<std::mutex> lock(record_mutex);
+	if (record_fp == nullptr) {
+		return;
+	}
+	record_enabled = false;
+	fclose(record_fp);
+	record_fp = nullptr;
+	SDL_Log("pdu_trace::stop_record");
+}
+
+bool recording()
+{
+	return record_enabled;
+}
+
+void record(int connection_id, const uint8_t* data, int len)
+{
+	if (len <= 0 || !record_enabled) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(record_mutex);
+	if (record_fp == nullptr) {
+		return;
+	}
+	const int64_t now = perf_counters::now_us();
+	if (record_start_us == 0) {
+		record_start_us = now;
+	}
+	write_u64(record_fp, now - record_start_us);
+	write_u32(record_fp, connection_id);
+	write_u32(record_fp, len);
+	fwrite(data, 1, len, record_fp);
+}
+
+bool load(const std::string& path, std::vector<trecord>& records)
+{
+	records.clear();
+	FILE* fp = fopen(path.c_str(), "rb");
+	if (fp == nullptr) {
+		return false;
+	}
+
+	char header[sizeof(magic)];
+	uint32_t ver = 0;
+	bool ok = fread(header, 1, sizeof(header), fp) == sizeof(header) && !memcmp(header, magic, sizeof(magic)) && read_u32(fp, &ver) && ver == version;
+	while (ok) {
+		uint64_t timestamp_us;
+		uint32_t connection_id, len;
+		if (!read_u64(fp, &timestamp_us)) {
+			// normal end of file.
+			break;
+		}
+		if (!read_u32(fp, &connection_id) || !read_u32(fp, &len) || len > 64 * 1024 * 1024) {
+			ok = false;
+			break;
+		}
+		records.push_back(trecord());
+		trecord& r = records.back();
+		r.timestamp_us = timestamp_us;
+		r.connection_id = connection_id;
+		r.bytes.resize(len);
+		if (fread(r.bytes.data(), 1, len, fp) != len) {
+			// truncated, for example launcher is killed when recording. keep complete ones.
+			records.pop_back();
+			break;
+		}
+	}
+	fclose(fp);
+	return ok;
+}
+
+}
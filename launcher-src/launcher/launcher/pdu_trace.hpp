@@ -0,0 +1,37 @@
+#ifndef PDU_TRACE_HPP_INCLUDED
+#define PDU_TRACE_HPP_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Record inbound connection bytes, with timing, to a compact binary trace, and read them back for replay.
+// bytes are what RdpConnection passes to OnRdpRequest, they include every keystroke,
+// so record only on demand, and the file is created with 0600.
+// bytes are recorded before FreeRDP decrypts them, so OnRdpRequest records only connections without
+// TLS/NLA and without standard RDP encryption. a session that negotiates TLS leaves no record.
+//
+// file format, little endian.
+//   header: "LPDU"(4) version(4)
+//   record: timestamp_us(8, relative to first record) connection_id(4) length(4) bytes(length)
+namespace pdu_trace {
+
+struct trecord
+{
+	int64_t timestamp_us;
+	int connection_id;
+	std::vector<uint8_t> bytes;
+};
+
+bool start_record(const std::string& path);
+void stop_record();
+bool recording();
+// called by rdpd thread. record only bytes consumed by rose_did_read, the rest will be passed again.
+void record(int connection_id, const uint8_t* data, int len);
+
+// read all records of trace file. return false if it isn't a valid trace.
+bool load(const std::string& path, std::vector<trecord>& records);
+
+}
+
+#endif
@@ -0,0 +1,453 @@
+#define GETTEXT_DOMAIN "launcher-lib"
+
+#include "global.hpp"
+#include "perf_counters.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <string.h>
+
+#include <SDL_log.h>
+#include <kosapi/net.h>
+
+#include "ResponseCode.h"
+#include "wml_exception.hpp"
+#include "filesystem.hpp"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+namespace perf_counters {
+
+// value < 4 has it's own bucket, others are log2 buckets, and every log2 bucket is split to 4 linear sub-buckets.
+// log2 buckets stop at msb 39, so the last bucket is [7 << 37, 2^40) and also holds every larger value.
+static const int max_msb = 39;
+static const int histogram_buckets = 4 + (max_msb - 1) * 4;
+static const int shard_count = 8;
+
+static const char* counter_names[] = {
+	"capture_frames",
+	"capture_bytes",
+	"sent_frames",
+	"sent_bytes",
+	"pauses",
+	"resumes",
+	"drops",
+	"input_reads",
+	"input_bytes",
+	"input_pdus",
+	"netd_requests",
+	"netd_failures",
+	"trace_unmatched",
+};
+
+static const char* gauge_names[] = {
+	"connections",
+	"queue_depth",
+	"write_buf_bytes",
+	"paused",
+};
+
+static const char* histogram_names[] = {
+	"encode_bytes",
+	"queue_depth",
+	"send_us",
+	"rtt_ms",
+	"netd_us",
+	"encode_us",
+	"deliver_us",
+	"queue_us",
+	"serialize_us",
+	"socket_us",
+	"frame_latency_us",
+	"input_photon_us",
+};
+
+struct alignas(64) tshard
+{
+	std::atomic<int64_t> counters[counter_count];
+	std::atomic<int64_t> counts[histogram_count][histogram_buckets];
+	std::atomic<int64_t> sums[histogram_count];
+	std::atomic<int64_t> maxs[histogram_count];
+};
+
+// static storage, so all atomics are zero-initialized.
+static tshard shards[shard_count];
+static std::atomic<int64_t> gauges[gauge_count];
+static std::atomic<int> next_shard;
+
+static tshard& current_shard()
+{
+	static thread_local int index = -1;
+	if (index == -1) {
+		index = next_shard.fetch_add(1, std::memory_order_relaxed) % shard_count;
+	}
+	return shards[index];
+}
+
+static int bucket_index(int64_t value)
+{
+	if (value < 4) {
+		return value < 0? 0: (int)value;
+	}
+	int msb = 0;
+	for (uint64_t v = value; v >>= 1; ) {
+		msb ++;
+	}
+	if (msb > max_msb) {
+		return histogram_buckets - 1;
+	}
+	return 4 + (msb - 2) * 4 + (int)((value >> (msb - 2)) & 3);
+}
+
+static int64_t bucket_lower(int index)
+{
+	if (index < 4) {
+		return index;
+	}
+	const int msb = (index - 4) / 4 + 2;
+	const int sub = (index - 4) % 4;
+	return (int64_t)(4 + sub) << (msb - 2);
+}
+
+void add(tcounter counter, int64_t value)
+{
+	current_shard().counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void set(tgauge gauge, int64_t value)
+{
+	gauges[gauge].store(value, std::memory_order_relaxed);
+}
+
+void record(thistogram histogram, int64_t value)
+{
+	tshard& shard = current_shard();
+	shard.counts[histogram][bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+	shard.sums[histogram].fetch_add(value, std::memory_order_relaxed);
+
+	// only this thread writes this shard's max in most time, so the loop almost never retries.
+	int64_t max = shard.maxs[histogram].load(std::memory_order_relaxed);
+	while (value > max && !shard.maxs[histogram].compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+}
+
+int64_t thistogram_snapshot::percentile(double p) const
+{
+	if (count == 0) {
+		return 0;
+	}
+	const int64_t rank = (int64_t)(p * count / 100);
+	int64_t seen = 0;
+	for (int index = 0; index < (int)buckets.size(); index ++) {
+		seen += buckets[index];
+		if (seen > rank) {
+			// upper bound of this bucket, but never exceed max.
+			const int64_t upper = index + 1 < histogram_buckets? bucket_lower(index + 1) - 1: max;
+			return upper < max? upper: max;
+		}
+	}
+	return max;
+}
+
+int64_t counter(tcounter counter)
+{
+	int64_t ret = 0;
+	for (int at = 0; at < shard_count; at ++) {
+		ret += shards[at].counters[counter].load(std::memory_order_relaxed);
+	}
+	return ret;
+}
+
+int64_t gauge(tgauge gauge)
+{
+	return gauges[gauge].load(std::memory_order_relaxed);
+}
+
+thistogram_snapshot histogram(thistogram histogram)
+{
+	thistogram_snapshot ret;
+	ret.buckets.resize(histogram_buckets, 0);
+	for (int at = 0; at < shard_count; at ++) {
+		const tshard& shard = shards[at];
+		for (int index = 0; index < histogram_buckets; index ++) {
+			const int64_t count = shard.counts[histogram][index].load(std::memory_order_relaxed);
+			ret.buckets[index] += count;
+			ret.count += count;
+		}
+		ret.sum += shard.sums[histogram].load(std::memory_order_relaxed);
+		const int64_t max = shard.maxs[histogram].load(std::memory_order_relaxed);
+		if (max > ret.max) {
+			ret.max = max;
+		}
+	}
+	return ret;
+}
+
+std::string to_json()
+{
+	std::stringstream ss;
+	ss << "{\"counters\":{";
+	for (int at = 0; at < counter_count; at ++) {
+		ss << (at != 0? ",": "") << "\"" << counter_names[at] << "\":" << counter((tcounter)at);
+	}
+	ss << "},\"gauges\":{";
+	for (int at = 0; at < gauge_count; at ++) {
+		ss << (at != 0? ",": "") << "\"" << gauge_names[at] << "\":" << gauge((tgauge)at);
+	}
+	ss << "},\"histograms\":{";
+	for (int at = 0; at < histogram_count; at ++) {
+		const thistogram_snapshot snapshot = histogram((thistogram)at);
+		ss << (at != 0? ",": "") << "\"" << histogram_names[at] << "\":{";
+		ss << "\"count\":" << snapshot.count << ",\"sum\":" << snapshot.sum << ",\"max\":" << snapshot.max;
+		ss << ",\"p50\":" << snapshot.percentile(50) << ",\"p90\":" << snapshot.percentile(90) << ",\"p99\":" << snapshot.percentile(99);
+		ss << "}";
+	}
+	ss << "}}";
+	return ss.str();
+}
+
+void reset()
+{
+	for (int at = 0; at < shard_count; at ++) {
+		tshard& shard = shards[at];
+		for (int counter = 0; counter < counter_count; counter ++) {
+			shard.counters[counter].store(0, std::memory_order_relaxed);
+		}
+		for (int histogram = 0; histogram < histogram_count; histogram ++) {
+			for (int index = 0; index < histogram_buckets; index ++) {
+				shard.counts[histogram][index].store(0, std::memory_order_relaxed);
+			}
+			shard.sums[histogram].store(0, std::memory_order_relaxed);
+			shard.maxs[histogram].store(0, std::memory_order_relaxed);
+		}
+	}
+	// gauges are current value, don't reset them.
+}
+
+int64_t now_us()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int net_send_msg(const char* msg, char* result, int max_bytes)
+{
+	const int64_t start = now_us();
+	const int code = kosNetSendMsg(msg, result, max_bytes);
+	record(histogram_netd_us, now_us() - start);
+	add(counter_netd_requests);
+	if (code < 0 || code >= ResponseCode::OperationFailed) {
+		add(counter_netd_failures);
+	}
+	return code;
+}
+
+std::string output_path(const std::string& name)
+{
+	// no separator, no "." or "..", and no hidden file.
+	if (name.empty() || name.size() > 64 || name[0] == '.' || name.find_first_of("/\\") != std::string::npos) {
+		return null_str;
+	}
+	const std::string dir = get_user_data_dir() + "/perf";
+#ifndef _WIN32
+	mkdir(dir.c_str(), 0700);
+#endif
+	return dir + "/" + name;
+}
+
+tserver::tserver()
+	: listen_fd_(-1)
+{
+	wake_fds_[0] = wake_fds_[1] = -1;
+}
+
+tserver::~tserver()
+{
+	stop();
+}
+
+void tserver::register_command(const std::string& name, const fcommand& command)
+{
+	VALIDATE(thread_.get() == nullptr, null_str);
+	commands_[name] = command;
+}
+
+#ifndef _WIN32
+static const char* server_name = "launcher-perf";
+
+// AID_ROOT, AID_SYSTEM and AID_SHELL in android_filesystem_config.h
+static const uid_t allowed_uids[] = {0, 1000, 2000};
+
+static bool peer_allowed(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+	if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0 || len != sizeof(cred)) {
+		return false;
+	}
+	for (int at = 0; at < (int)(sizeof(allowed_uids) / sizeof(allowed_uids[0])); at ++) {
+		if (cred.uid == allowed_uids[at]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void tserver::start()
+{
+	if (thread_.get() != nullptr) {
+		return;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		SDL_Log("perf_counters::tserver::start, socket fail, errno: %i", errno);
+		return;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	// abstract namespace: sun_path[0] is '\0'.
+	const int name_len = strlen(server_name);
+	memcpy(addr.sun_path + 1, server_name, name_len);
+	const socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + 1 + name_len;
+	if (bind(fd, (struct sockaddr*)&addr, addr_len) != 0 || listen(fd, 4) != 0 || pipe2(wake_fds_, O_CLOEXEC) != 0) {
+		SDL_Log("perf_counters::tserver::start, bind/listen @%s fail, errno: %i", server_name, errno);
+		close(fd);
+		wake_fds_[0] = wake_fds_[1] = -1;
+		return;
+	}
+	listen_fd_ = fd;
+	thread_.reset(new std::thread(&tserver::run, this));
+}
+
+void tserver::stop()
+{
+	if (thread_.get() == nullptr) {
+		return;
+	}
+	const char wake = 'q';
+	ssize_t ret;
+	do {
+		ret = write(wake_fds_[1], &wake, 1);
+	} while (ret < 0 && errno == EINTR);
+	// pipe is empty and run() polls it without timeout, join would block forever if it isn't written.
+	VALIDATE(ret == 1, null_str);
+	thread_->join();
+	thread_.reset();
+
+	close(listen_fd_);
+	close(wake_fds_[0]);
+	close(wake_fds_[1]);
+	listen_fd_ = -1;
+	wake_fds_[0] = wake_fds_[1] = -1;
+}
+
+void tserver::run()
+{
+	struct pollfd fds[2];
+	fds[0].fd = listen_fd_;
+	fds[0].events = POLLIN;
+	fds[1].fd = wake_fds_[0];
+	fds[1].events = POLLIN;
+
+	while (true) {
+		fds[0].revents = fds[1].revents = 0;
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (fds[1].revents != 0) {
+			break;
+		}
+		if (fds[0].revents & POLLIN) {
+			int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd >= 0) {
+				if (peer_allowed(fd)) {
+					handle_client(fd);
+				} else {
+					SDL_Log("perf_counters::tserver::run, reject peer that isn't root/system/shell");
+				}
+				close(fd);
+			}
+		}
+	}
+}
+
+void tserver::handle_client(int fd)
+{
+	// don't let a silent client block other queries.
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	char cmd[128];
+	int len = 0;
+	while (len < (int)sizeof(cmd) - 1) {
+		const int ret = read(fd, cmd + len, sizeof(cmd) - 1 - len);
+		if (ret <= 0) {
+			break;
+		}
+		len += ret;
+		if (memchr(cmd, '\n', len) != nullptr) {
+			break;
+		}
+	}
+	cmd[len] = '\0';
+	while (len > 0 && (cmd[len - 1] == '\n' || cmd[len - 1] == '\r' || cmd[len - 1] == ' ')) {
+		cmd[-- len] = '\0';
+	}
+
+	std::string result;
+	if (len == 0 || !strcmp(cmd, "stats")) {
+		result = to_json();
+	} else if (!strcmp(cmd, "reset")) {
+		reset();
+		result = to_json();
+	} else {
+		const char* space = strchr(cmd, ' ');
+		const std::string name = space != nullptr? std::string(cmd, space - cmd): std::string(cmd);
+		std::map<std::string, fcommand>::const_iterator it = commands_.find(name);
+		if (it != commands_.end()) {
+			result = it->second(space != nullptr? std::string(space + 1): std::string());
+		} else {
+			// don't echo cmd, it isn't json-safe.
+			result = "{\"error\":\"unknown command\"}";
+		}
+	}
+	result.push_back('\n');
+
+	const char* ptr = result.c_str();
+	int remain = result.size();
+	while (remain > 0) {
+		const int ret = write(fd, ptr, remain);
+		if (ret <= 0) {
+			break;
+		}
+		ptr += ret;
+		remain -= ret;
+	}
+}
+
+#else
+// no unix socket on windows, counters can still be read by to_json().
+void tserver::start() {}
+void tserver::stop() {}
+void tserver::run() {}
+void tserver::handle_client(int fd) {}
+#endif
+
+}
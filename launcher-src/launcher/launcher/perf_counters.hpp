@@ -0,0 +1,130 @@
+#ifndef PERF_COUNTERS_HPP_INCLUDED
+#define PERF_COUNTERS_HPP_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <map>
+#include <functional>
+
+// Process-wide performance counters, gauges and histograms.
+// Writers update a per-thread shard with relaxed atomics, so hot paths (rdpd_slice, capture, input)
+// never take a lock. Readers aggregate all shards when taking a snapshot.
+namespace perf_counters {
+
+enum tcounter {
+	counter_capture_frames,		// frames output by encoder
+	counter_capture_bytes,
+	counter_sent_frames,		// frames dequeued from encoded_images and sent to peer
+	counter_sent_bytes,
+	counter_pauses,				// kosPauseRecordScreen(true)
+	counter_resumes,			// kosPauseRecordScreen(false)
+	counter_drops,				// connections closed by server because handshake/capture/rtt timeout
+	counter_input_reads,		// OnRdpRequest calls
+	counter_input_bytes,
+	counter_input_pdus,			// rose_did_read calls
+	counter_netd_requests,
+	counter_netd_failures,
+	counter_trace_unmatched,	// dequeued frame that can't be found in kosGetFrameTraces
+	counter_count
+};
+
+enum tgauge {
+	gauge_connections,
+	gauge_queue_depth,			// encoded_images.size()
+	gauge_write_buf_bytes,
+	gauge_paused,
+	gauge_count
+};
+
+enum thistogram {
+	histogram_encode_bytes,		// size of one encoded frame
+	histogram_queue_depth,		// encoded_images.size() sampled once per rdpd_slice
+	histogram_send_us,			// rose_did_update_peer_send of one frame
+	histogram_rtt_ms,
+	histogram_netd_us,			// kosNetSendMsg round-trip
+	// frame stages, see frame_trace.hpp
+	histogram_encode_us,
+	histogram_deliver_us,
+	histogram_queue_us,
+	histogram_serialize_us,
+	histogram_socket_us,
+	histogram_frame_latency_us,	// pts --> last byte leaves write_buf
+	histogram_input_photon_us,	// kosSendInput batch --> first frame encoded after it
+	histogram_count
+};
+
+void add(tcounter counter, int64_t value = 1);
+void set(tgauge gauge, int64_t value);
+void record(thistogram histogram, int64_t value);
+
+struct thistogram_snapshot
+{
+	thistogram_snapshot()
+		: count(0)
+		, sum(0)
+		, max(0)
+	{}
+
+	int64_t percentile(double p) const;
+
+	int64_t count;
+	int64_t sum;
+	int64_t max;
+	std::vector<int64_t> buckets;
+};
+
+int64_t counter(tcounter counter);
+int64_t gauge(tgauge gauge);
+thistogram_snapshot histogram(thistogram histogram);
+
+// all counters, gauges and histograms(count/sum/max/p50/p90/p99) as one json object.
+std::string to_json();
+void reset();
+
+// monotonic clock, in microseconds.
+int64_t now_us();
+
+// kosNetSendMsg, and record it's round-trip into histogram_netd_us.
+int net_send_msg(const char* msg, char* result, int max_bytes);
+
+// files written or read by tserver's commands(trace, pdu record/replay) must be in <user data dir>/perf.
+// name must be a plain file name, return it's full path, or empty if name is invalid.
+std::string output_path(const std::string& name);
+
+// Answer queries from local unix socket(abstract namespace: @launcher-perf).
+// every connection writes one command line, and receive one json line.
+// only root, system and shell(adb) can connect, others are closed without reply.
+//   stats: to_json()
+//   reset: reset() then to_json()
+//   <name> <args>: command registered by register_command.
+class tserver
+{
+public:
+	typedef std::function<std::string (const std::string& args)> fcommand;
+
+	tserver();
+	~tserver();
+
+	// must be called before start.
+	void register_command(const std::string& name, const fcommand& command);
+
+	void start();
+	void stop();
+
+private:
+	void run();
+	void handle_client(int fd);
+
+private:
+	int listen_fd_;
+	int wake_fds_[2];
+	std::unique_ptr<std::thread> thread_;
+	std::map<std::string, fcommand> commands_;
+};
+
+}
+
+#endif
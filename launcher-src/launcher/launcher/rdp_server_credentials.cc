@@ -0,0 +1,145 @@
+#include "rdp_server_credentials.h"
+
+#include <vector>
+
+#include "base/files/file.h"
+#include "base/files/file_path.h"
+#include "base/files/file_util.h"
+#include "base/no_destructor.h"
+#include "base/rand_util.h"
+#include "base/time/time.h"
+#include "build/build_config.h"
+#include "net/cert/x509_util.h"
+#include "third_party/boringssl/src/include/openssl/bio.h"
+#include "third_party/boringssl/src/include/openssl/pem.h"
+
+#include <SDL_log.h>
+#include <SDL_timer.h>
+
+namespace net {
+
+static const char* key_file = "rdpd_key.p8"; // PKCS#8 DER
+static const char* cert_file = "rdpd_cert.der";
+
+RdpServerCredentials& RdpServerCredentials::Get()
+{
+	static base::NoDestructor<RdpServerCredentials> instance;
+	return *instance;
+}
+
+// private key must not be readable by others. base::WriteFile creates file with 0666 & ~umask.
+static bool WritePrivateFile(const base::FilePath& path, const char* data, int size)
+{
+	base::File file(path, base::File::FLAG_CREATE_ALWAYS | base::File::FLAG_WRITE);
+	if (!file.IsValid()) {
+		return false;
+	}
+#if defined(OS_POSIX)
+	// base::File creates it with 0600, but an existed one keeps it's mode.
+	if (!base::SetPosixFilePermissions(path, base::FILE_PERMISSION_READ_BY_USER | base::FILE_PERMISSION_WRITE_BY_USER)) {
+		return false;
+	}
+#endif
+	return file.WriteAtCurrentPos(data, size) == size;
+}
+
+static std::string PrivateKeyToPEM(EVP_PKEY* key)
+{
+	bssl::UniquePtr<BIO> bio(BIO_new(BIO_s_mem()));
+	if (!PEM_write_bio_PrivateKey(bio.get(), key, nullptr, nullptr, 0, nullptr, nullptr)) {
+		return std::string();
+	}
+	const uint8_t* contents;
+	size_t len;
+	if (!BIO_mem_contents(bio.get(), &contents, &len)) {
+		return std::string();
+	}
+	return std::string(reinterpret_cast<const char*>(contents), len);
+}
+
+RdpServerCredentials::RdpServerCredentials()
+{}
+
+bool RdpServerCredentials::Warm(const std::string& dir)
+{
+	base::AutoLock lock(lock_);
+	if (cert_.get() != nullptr) {
+		return true;
+	}
+
+	const uint32_t start = SDL_GetTicks();
+	if (!Load(dir) && !Generate(dir)) {
+		return false;
+	}
+	std::string cert_pem;
+	std::string key_pem = PrivateKeyToPEM(key_->key());
+	if (key_pem.empty() || !X509Certificate::GetPEMEncoded(cert_->cert_buffer(), &cert_pem)) {
+		key_.reset();
+		cert_ = nullptr;
+		return false;
+	}
+	key_pem_.swap(key_pem);
+	cert_pem_.swap(cert_pem);
+	SDL_Log("RdpServerCredentials::Warm, used %u ms", SDL_GetTicks() - start);
+	return true;
+}
+
+bool RdpServerCredentials::Load(const std::string& dir)
+{
+	const base::FilePath path = base::FilePath::FromUTF8Unsafe(dir);
+	std::string key_der, cert_der;
+	if (!base::ReadFileToString(path.AppendASCII(key_file), &key_der) || !base::ReadFileToString(path.AppendASCII(cert_file), &cert_der)) {
+		return false;
+	}
+
+	std::vector<uint8_t> key_info(key_der.begin(), key_der.end());
+	std::unique_ptr<crypto::ECPrivateKey> key = crypto::ECPrivateKey::CreateFromPrivateKeyInfo(key_info);
+	scoped_refptr<X509Certificate> cert = X509Certificate::CreateFromBytes(cert_der.data(), cert_der.size());
+	if (key.get() == nullptr || cert.get() == nullptr) {
+		SDL_Log("RdpServerCredentials::Load, %s or %s is invalid", key_file, cert_file);
+		return false;
+	}
+	if (cert->valid_expiry() < base::Time::Now() + base::TimeDelta::FromDays(1)) {
+		SDL_Log("RdpServerCredentials::Load, certificate is expired");
+		return false;
+	}
+
+	key_ = std::move(key);
+	cert_ = std::move(cert);
+	return true;
+}
+
+bool RdpServerCredentials::Generate(const std::string& dir)
+{
+	std::unique_ptr<crypto::ECPrivateKey> key = crypto::ECPrivateKey::Create();
+	if (key.get() == nullptr) {
+		return false;
+	}
+
+	const base::Time now = base::Time::Now();
+	std::string cert_der;
+	if (!x509_util::CreateSelfSignedCert(key->key(), x509_util::DIGEST_SHA256, "CN=launcher", base::RandUint64() & 0x7fffffff,
+			now - base::TimeDelta::FromDays(1), now + base::TimeDelta::FromDays(3650), &cert_der)) {
+		return false;
+	}
+	scoped_refptr<X509Certificate> cert = X509Certificate::CreateFromBytes(cert_der.data(), cert_der.size());
+	if (cert.get() == nullptr) {
+		return false;
+	}
+
+	// fail to save isn't fatal, next start will generate again.
+	std::vector<uint8_t> key_info;
+	if (key->ExportPrivateKey(&key_info)) {
+		const base::FilePath path = base::FilePath::FromUTF8Unsafe(dir);
+		base::CreateDirectory(path);
+		WritePrivateFile(path.AppendASCII(key_file), reinterpret_cast<const char*>(key_info.data()), key_info.size());
+		base::WriteFile(path.AppendASCII(cert_file), cert_der.data(), cert_der.size());
+	}
+
+	key_ = std::move(key);
+	cert_ = std::move(cert);
+	SDL_Log("RdpServerCredentials::Generate, new ECDSA P-256 key and certificate");
+	return true;
+}
+
+}  // namespace net
@@ -0,0 +1,51 @@
+#ifndef RDP_SERVER_CREDENTIALS_H_INCLUDED
+#define RDP_SERVER_CREDENTIALS_H_INCLUDED
+
+#include <memory>
+#include <string>
+
+#include "base/memory/ref_counted.h"
+#include "base/synchronization/lock.h"
+#include "crypto/ec_private_key.h"
+#include "net/cert/x509_certificate.h"
+
+namespace net {
+
+// Server key and certificate are loaded or generated once, then kept in memory across sessions.
+// TLS is done by FreeRDP on every connection, OnConnect passes PEM of them to peer's settings,
+// so FreeRDP neither reads nor generates key/certificate on connection path.
+// Key is ECDSA P-256, it is much faster than RSA on low-end ARM.
+// FreeRDP builds an SSL_CTX per peer, so every connection is a full handshake: there is no session
+// resumption, and cipher suites are FreeRDP's defaults for an ECDSA key.
+class RdpServerCredentials
+{
+public:
+	static RdpServerCredentials& Get();
+
+	// Load from dir, or generate and save to dir. Call it in SetUp, not on connection path.
+	bool Warm(const std::string& dir);
+	bool warmed() const { return cert_.get() != nullptr; }
+
+	// empty if hasn't warmed.
+	const std::string& certificate_pem() const { return cert_pem_; }
+	const std::string& private_key_pem() const { return key_pem_; }
+	X509Certificate* certificate() { return cert_.get(); }
+	crypto::ECPrivateKey* private_key() { return key_.get(); }
+
+private:
+	RdpServerCredentials();
+
+	bool Load(const std::string& dir);
+	bool Generate(const std::string& dir);
+
+private:
+	base::Lock lock_;
+	std::unique_ptr<crypto::ECPrivateKey> key_;
+	scoped_refptr<X509Certificate> cert_;
+	std::string key_pem_;
+	std::string cert_pem_;
+};
+
+}  // namespace net
+
+#endif
@@ -54,6 +54,9 @@ using namespace std::placeholders;
 
 #include <kosapi/sys.h>
 #include "gui/dialogs/explorer.hpp"
+#include "perf_counters.hpp"
+#include "rdp_server_credentials.h"
+#include "filesystem.hpp"
 
 UINT wf_leagor_server_receive_capabilities(LeagorCommonContext* context2, const LEAGOR_CAPABILITIES* capabilities)
 {
@@ -89,6 +92,48 @@ UINT wf_leagor_server_receive_explorer_update(LeagorCommonContext* context2, con
 
 namespace net {
 
+// when replay, rose_connection is treplay_source, not RdpConnection.
+struct treplay_source
+{
+	treplay_source()
+		: data(nullptr)
+		, len(0)
+		, consumed(0)
+	{}
+
+	const uint8_t* data;
+	int len;
+	int consumed;
+};
+
+// state of one replay, it lives across replay_pdu_step tasks.
+struct treplay
+{
+	treplay(bool realtime)
+		: realtime(realtime)
+		, peer(nullptr)
+		, next(0)
+		, connection_id(0)
+		, start_us(0)
+		, replayed(0)
+		, pdus(0)
+		, bytes(0)
+		, iret(1)
+	{}
+
+	std::vector<pdu_trace::trecord> records;
+	const bool realtime;
+	freerdp_peer* peer;
+	treplay_source source;
+	size_t next;
+	int connection_id;
+	int64_t start_us;
+	int replayed;
+	int pdus;
+	int64_t bytes;
+	int iret;
+};
+
 RdpServerRose::RdpServerRose(base::Thread& thread, base::WaitableEvent& e)
 	: thread_(thread)
 	, delete_pend_tasks_e_(e)
@@ -97,10 +142,10 @@ RdpServerRose::RdpServerRose(base::Thread& thread, base::WaitableEvent& e)
 	, weak_ptr_factory_(this)
 	, check_slice_timeout_(300) // 300 ms
 	, slice_running_(false)
-	, startup_verbose_ticks_(0)
-	, last_verbose_ticks_(0)
 	, client_os_(nposm)
+	, rtt_response_sequence_number_(0)
 {
+	memset(rtt_request_ticks_, 0, sizeof(rtt_request_ticks_));
 	freerdp_server_ = rose_init_subsystem();
 }
 
@@ -109,6 +154,9 @@ RdpServerRose::~RdpServerRose()
 	VALIDATE_IN_RDPD_THREAD();
 
 	SDL_Log("RdpServerRose::~RdpServerRose()---");
+	if (replay_.get() != nullptr) {
+		finish_replay_pdu_trace("rdpd is stopping");
+	}
 	// don't call serve_.reset(), after server_->Release(), some require it's some variable keep valid.
 	server_->CloseAllConnection();
 	rose_release_subsystem(freerdp_server_);
@@ -132,6 +180,11 @@ void RdpServerRose::SetUp(uint32_t ipaddr)
 	server_.reset(new RdpServer(std::move(server_socket), this));
 	server_->GetLocalAddress(&server_address_);
 	server_url_ = server_address_.ToString();
+
+	// key and certificate are kept in memory across sessions, don't setup them on connection path.
+	if (!RdpServerCredentials::Get().Warm(get_user_data_dir() + "/rdpd")) {
+		SDL_Log("RdpServerRose::SetUp, warm credentials fail");
+	}
 }
 
 void RdpServerRose::TearDown()
@@ -141,6 +194,27 @@ void RdpServerRose::TearDown()
 	base::RunLoop().RunUntilIdle();
 }
 
+// use in-memory key and certificate, instead of CertificateFile/PrivateKeyFile that shadow server set.
+// shadow server also copies PrivateKeyFile to RdpKeyFile, the on-disk RSA key of standard RDP security.
+// drop it too, so the connection never loads it. standard RDP security is left without encryption.
+static void set_tls_credentials(rdpSettings* settings)
+{
+	RdpServerCredentials& credentials = RdpServerCredentials::Get();
+	if (!credentials.warmed()) {
+		return;
+	}
+	free(settings->CertificateFile);
+	settings->CertificateFile = nullptr;
+	free(settings->PrivateKeyFile);
+	settings->PrivateKeyFile = nullptr;
+	free(settings->RdpKeyFile);
+	settings->RdpKeyFile = nullptr;
+	free(settings->CertificateContent);
+	settings->CertificateContent = strdup(credentials.certificate_pem().c_str());
+	free(settings->PrivateKeyContent);
+	settings->PrivateKeyContent = strdup(credentials.private_key_pem().c_str());
+}
+
 static SSIZE_T did_rose_read_layer(rdpContext* context, BYTE* data, size_t bytes)
 {
 	freerdp_peer* client = context->peer;
@@ -166,9 +240,32 @@ static int did_rose_write_layer(rdpContext* context, BYTE* data, size_t bytes)
 		return 0;
 	}
 	VALIDATE(connection->client_ptr == client, null_str);
+	rose->frame_tracer().did_write_layer(bytes);
 	return connection->did_write_layer(data, bytes);
 }
 
+static SSIZE_T did_replay_read_layer(rdpContext* context, BYTE* data, size_t bytes)
+{
+	treplay_source* source = reinterpret_cast<treplay_source*>(context->rdp->rose.rose_connection);
+	const int size = SDL_min((int)bytes, source->len - source->consumed);
+	memcpy(data, source->data + source->consumed, size);
+	source->consumed += size;
+	return size;
+}
+
+static int did_replay_write_layer(rdpContext* context, BYTE* data, size_t bytes)
+{
+	// there is no client, discard.
+	return bytes <= INT32_MAX? (int)bytes: -1;
+}
+
+// after a TLS/NLA handshake, or with standard RDP security that encrypts, inbound bytes are ciphertext.
+// keys are per session, a replay of them can't get past the handshake, so only plaintext connections are recorded.
+static bool plaintext_transport(const rdpSettings* settings)
+{
+	return settings->SelectedProtocol == PROTOCOL_RDP && settings->EncryptionLevel == ENCRYPTION_LEVEL_NONE;
+}
+
 void RdpServerRose::clipboard_updated(const std::string& text)
 {
 	threading::lock lock(server_->connections_mutex_);
@@ -248,6 +345,34 @@ bool RdpServerRose::can_hdrop_paste() const
 	return ret;
 }
 
+// updates queued in one slice are sent together, so an update that is superseded by a later one needn't be sent.
+// SHOWN/HIDDEN: last one wins.
+// CAN_PASTE: state and position of current drag, last one wins too, but it must not cross START_DRAG, that begins a new drag.
+static void coalesce_explorer_update(std::vector<LEAGOR_EXPLORER_UPDATE>& updates, const LEAGOR_EXPLORER_UPDATE& update)
+{
+	if (update.code == LG_EXPLORER_CODE_SHOWN || update.code == LG_EXPLORER_CODE_HIDDEN) {
+		for (std::vector<LEAGOR_EXPLORER_UPDATE>::iterator it = updates.begin(); it != updates.end(); ) {
+			if (it->code == LG_EXPLORER_CODE_SHOWN || it->code == LG_EXPLORER_CODE_HIDDEN) {
+				it = updates.erase(it);
+			} else {
+				++ it;
+			}
+		}
+
+	} else if (update.code == LG_EXPLORER_CODE_CAN_PASTE) {
+		for (std::vector<LEAGOR_EXPLORER_UPDATE>::reverse_iterator it = updates.rbegin(); it != updates.rend(); ++ it) {
+			if (it->code == LG_EXPLORER_CODE_START_DRAG) {
+				break;
+			}
+			if (it->code == LG_EXPLORER_CODE_CAN_PASTE) {
+				*it = update;
+				return;
+			}
+		}
+	}
+	updates.push_back(update);
+}
+
 void RdpServerRose::push_explorer_update(uint32_t code, uint32_t data1, uint32_t data2, uint32_t data3)
 {
 	if (server_->connection_count() == 0) {
@@ -263,12 +388,13 @@ void RdpServerRose::push_explorer_update(uint32_t code, uint32_t data1, uint32_t
 	update.data3 = data3;
 
 	threading::lock lock2(rdpd_thread_explorer_update_mutex_);
-	rdpd_thread_explorer_update_.push_back(update);
+	coalesce_explorer_update(rdpd_thread_explorer_update_, update);
 }
 
 void RdpServerRose::did_slice_quited(int timeout1)
 {
 	VALIDATE(server_.get() != nullptr, null_str);
+	perf_counters::set(perf_counters::gauge_connections, server_->connection_count());
 	if (server_->connection_count() == 0) {
 		SDL_Log("will stop rdpd_slice");
 		slice_running_ = false;
@@ -286,11 +412,32 @@ void RdpServerRose::handle_pause_record_screen(RdpConnection& connection, bool d
 	bool current_paused = kosRecordScreenPaused();
 	if (desire_pause && !current_paused) {
 		kosPauseRecordScreen(desire_pause);
+		perf_counters::add(perf_counters::counter_pauses);
 		SDL_Log("%u handle_pause_record_screen, pause capture screen", SDL_GetTicks());
 
 	} else if (!desire_pause && current_paused) {
 		SDL_Log("%u handle_pause_record_screen, continue capture screen", SDL_GetTicks());
 		kosPauseRecordScreen(desire_pause);
+		perf_counters::add(perf_counters::counter_resumes);
+	}
+	perf_counters::set(perf_counters::gauge_paused, desire_pause? 1: 0);
+}
+
+void RdpServerRose::record_rtt(uint16_t response_sequence_number)
+{
+	// rdpd_slice runs every 20 ms, so rtt_ms has 20 ms granularity.
+	if ((uint16_t)(response_sequence_number - rtt_response_sequence_number_) > 4) {
+		// new connection, or sequence number jumped.
+		rtt_response_sequence_number_ = response_sequence_number;
+		return;
+	}
+	while (rtt_response_sequence_number_ != response_sequence_number) {
+		rtt_response_sequence_number_ ++;
+		uint32_t& ticks = rtt_request_ticks_[rtt_response_sequence_number_ & 3];
+		if (ticks != 0) {
+			perf_counters::record(perf_counters::histogram_rtt_ms, SDL_GetTicks() - ticks);
+			ticks = 0;
+		}
 	}
 }
 
@@ -321,6 +468,7 @@ void RdpServerRose::rdpd_slice(int timeout)
 			SDL_Log("%u rdpd_slice(%i) hasn't handshaked over %u seconds, think as disconnect", 
 				now, connection->id(),
 				now - connection->create_ticks());
+			perf_counters::add(perf_counters::counter_drops);
 			server_->Close(connection->id());
 		}
 		return;
@@ -344,8 +492,20 @@ void RdpServerRose::rdpd_slice(int timeout)
 
 	int images = 0;
 	int current_orientation = nposm;
+	{
+		// capture thread accumulates them, harvest on every slice.
+		threading::lock lock(record_screen.encoded_images_mutex());
+		perf_counters::add(perf_counters::counter_capture_frames, record_screen.last_capture_frames);
+		perf_counters::add(perf_counters::counter_capture_bytes, record_screen.last_capture_bytes);
+		record_screen.last_capture_frames = 0;
+		record_screen.last_capture_bytes = 0;
+		images = record_screen.encoded_images.size();
+	}
+	perf_counters::record(perf_counters::histogram_queue_depth, images);
+
 	while (true) {
 		surface->h264Length = 0;
+		bool dequeued = false;
 		{
 			threading::lock lock(record_screen.encoded_images_mutex());
 			if (!record_screen.encoded_images.empty() && !connection->write_buf_is_alert() && can_xmit_screen_surface(freerdp_server_, peer, &gfxstatus_)) {
@@ -363,14 +523,28 @@ void RdpServerRose::rdpd_slice(int timeout)
 				region16_union_rect(&(surface->invalidRegion), &(surface->invalidRegion), &invalidRect);
 
 				current_orientation = image.orientation;
+				dequeued = true;
 			}
 			images = record_screen.encoded_images.size();
 		}
+		const int frame_bytes = surface->h264Length;
+		if (dequeued) {
+			frame_tracer_.did_dequeue(frame_bytes);
+		}
+		const int64_t send_start_us = perf_counters::now_us();
 		rose_did_update_peer_send(freerdp_server_, peer, &gfxstatus_, UpdateSubscriber_);
+		if (dequeued) {
+			frame_tracer_.did_send();
+		}
 		if (surface->h264Length == 0) {
 			break;
 		}
+		perf_counters::record(perf_counters::histogram_send_us, perf_counters::now_us() - send_start_us);
+		perf_counters::record(perf_counters::histogram_encode_bytes, frame_bytes);
+		perf_counters::add(perf_counters::counter_sent_frames);
+		perf_counters::add(perf_counters::counter_sent_bytes, frame_bytes);
 	}
+	perf_counters::set(perf_counters::gauge_queue_depth, images);
 	if (current_orientation != nposm) {
 		leagorchannel_send_video_orientation_request(context, freerdp_server_->initialOrientation, current_orientation);
 	}
@@ -386,10 +560,12 @@ void RdpServerRose::rdpd_slice(int timeout)
 			now, connection->id(),
 			1.0 * write_buf->total_size() / 1024, 1.0 * connection->alert_buffer_threshold()  / 1024,
 			connection->next_rtt_sequence_number, context->autodetect->lastSequenceNumber, now - connection->handshaked_ticks());
+		perf_counters::add(perf_counters::counter_drops);
 		server_->Close(connection->id());
 		return;
 	}
 
+	record_rtt(context->autodetect->lastSequenceNumber);
 	if (connection->next_rtt_ticks != 0 && now >= connection->next_rtt_ticks) {
 		// SDL_Log("%u rdpd_slice(%i), next_rtt_sequence_number: %i, recv: lastSequenceNumber: %i", now, connection->id(), (int)connection->next_rtt_sequence_number, (int)context->autodetect->lastSequenceNumber);
 		const int sequence_number_threshold = 3;
@@ -400,20 +576,27 @@ void RdpServerRose::rdpd_slice(int timeout)
 				1.0 * write_buf->total_size() / 1024, 1.0 * connection->alert_buffer_threshold()  / 1024,
 				connection->next_rtt_sequence_number, context->autodetect->lastSequenceNumber, 
 				diff, sequence_number_threshold);
+			perf_counters::add(perf_counters::counter_drops);
 			server_->Close(connection->id());
 			return;
 		}
+		rtt_request_ticks_[connection->next_rtt_sequence_number & 3] = now;
 		peer->autodetect->RTTMeasureRequest(context, connection->next_rtt_sequence_number ++);
 		connection->next_rtt_ticks += rtt_threshold;
 	}
 
 	if (!rdpd_thread_explorer_update_.empty()) {
-		threading::lock lock2(rdpd_thread_explorer_update_mutex_);
-		for (std::vector<LEAGOR_EXPLORER_UPDATE>::const_iterator it  = rdpd_thread_explorer_update_.begin(); it != rdpd_thread_explorer_update_.end(); ++ it) {
+		{
+			// swap out, don't hold mutex when sending, push_explorer_update is called by main thread.
+			threading::lock lock2(rdpd_thread_explorer_update_mutex_);
+			rdpd_thread_explorer_update_.swap(sending_explorer_update_);
+		}
+		for (std::vector<LEAGOR_EXPLORER_UPDATE>::const_iterator it  = sending_explorer_update_.begin(); it != sending_explorer_update_.end(); ++ it) {
 			const LEAGOR_EXPLORER_UPDATE& update = *it;
 			leagorchannel_send_explorer_update(context, &update);
 		}
-		rdpd_thread_explorer_update_.clear();
+		// keep capacity, next swap reuses it.
+		sending_explorer_update_.clear();
 	}
 
 	// if (record_screen.thread_started()) {
@@ -427,37 +610,26 @@ void RdpServerRose::rdpd_slice(int timeout)
 		}
 	// }
 
-	// print debug log.
-	if (startup_verbose_ticks_ == 0) {
-		startup_verbose_ticks_ = now;
-		last_verbose_ticks_ = startup_verbose_ticks_;
-	}
-
-	if (now - last_verbose_ticks_ >= 10000) {
-		uint32_t total_second = (now - startup_verbose_ticks_) / 1000;
-		uint32_t elapsed_second = (now - last_verbose_ticks_) / 1000;
-		last_verbose_ticks_ = now;
-		SDL_Log("rdpd_slice(%i) %s, %s, unsend %i, max: %3.1fK, cur: %3.1fK/%3.1fK, seqnum: %u/%u, %s. last %u[s] %i frames, %3.1fK",
-			connection->id(), format_elapse_hms2(total_second, false).c_str(), kosRecordScreenPaused()? "paused": "running",
-			images, 1.0 * record_screen.max_one_frame_bytes / 1024,
-			1.0 * write_buf->total_size() / 1024, 
-			1.0 * connection->alert_buffer_threshold() /  1024,
-			connection->next_rtt_sequence_number, context->autodetect->lastSequenceNumber,
-			client->suppressOutput? "suppress": "send",
-			elapsed_second, record_screen.last_capture_frames, 1.0 * record_screen.last_capture_bytes / 1024);
-		record_screen.last_capture_frames = 0;
-		record_screen.last_capture_bytes = 0;
-	}
+	perf_counters::set(perf_counters::gauge_write_buf_bytes, write_buf->total_size());
+	frame_tracer_.check_socket(write_buf->total_size());
 }
 
 void RdpServerRose::OnConnect(RdpConnection& connection)
 {
 	VALIDATE_IN_RDPD_THREAD();
 
+	// replay and live session share freerdp_server_, live one wins.
+	if (replay_.get() != nullptr) {
+		finish_replay_pdu_trace("interrupted by connection");
+	}
 	kos_check_resize(freerdp_server_);
 
 	freerdp_peer* client = freerdp_peer_new(fake_peer_socket_);
 	UpdateSubscriber_ = rose_did_shadow_peer_connect(freerdp_server_, client, &gfxstatus_);
+	set_tls_credentials(client->context->settings);
+	if (preferences::relative_mouse() && !kosSetMouseMode(KOS_MOUSE_MODE_RELATIVE, preferences::relative_mouse_scale())) {
+		SDL_Log("OnConnect, create relative mouse fail, use absolute mouse");
+	}
 	rose_register_extra(client->context, did_rose_read_layer, did_rose_write_layer, this, &connection);
 	// client->rose_read_layer = did_rose_read_layer;
 	// client->rose_write_layer = did_rose_write_layer;
@@ -470,6 +642,9 @@ void RdpServerRose::OnConnect(RdpConnection& connection)
 	// Structures in freerdp is a bit messy and can't find a good variable to count how many client in real time.
 	// temporarily use was_clients to store how many clients that it OnConnect called.
 	client->was_clients = server_->connection_count();
+	perf_counters::set(perf_counters::gauge_connections, server_->connection_count());
+	memset(rtt_request_ticks_, 0, sizeof(rtt_request_ticks_));
+	frame_tracer_.reset();
 
 	if (!slice_running_) {
 		SDL_Log("will run rdpd_slice");
@@ -490,10 +665,22 @@ void RdpServerRose::OnRdpRequest(RdpConnection::tdid_read_lock& lock, RdpConnect
 
 	bool previous_actived = client->activated;
 
+	perf_counters::add(perf_counters::counter_input_reads);
+	perf_counters::add(perf_counters::counter_input_bytes, buf_len);
+
 	// this read may be have multi-pdu.
+	// input events decoded from them are injected together, one frame for one read.
 	int iret = 1;
+	int pdus = 0;
+	kosBeginInputBatch();
 	while (iret == 1 && lock.consumed() < buf_len) {
 		iret = rose_did_read(rdp);
+		pdus ++;
+	}
+	kosEndInputBatch();
+	perf_counters::add(perf_counters::counter_input_pdus, pdus);
+	if (pdu_trace::recording() && plaintext_transport(peer->context->settings)) {
+		pdu_trace::record(connection.id(), buf, lock.consumed());
 	}
 
 	if (!previous_actived && client->activated) {
@@ -524,10 +711,128 @@ void RdpServerRose::OnClose(RdpConnection& connection)
 	}
 
 	freerdp_server_->rose_delegate = nullptr;
+	// OnConnect of next connection selects it again from preferences.
+	kosSetMouseMode(KOS_MOUSE_MODE_ABSOLUTE, 0);
 	client_os_ = nposm;
 	SDL_Log("------RdpServerRose::Close(%i) X", connection.id());
 }
 
+std::string RdpServerRose::start_replay_pdu_trace(std::vector<pdu_trace::trecord>& records, bool realtime)
+{
+	VALIDATE_IN_RDPD_THREAD();
+
+	if (server_->connection_count() != 0) {
+		return "{\"error\":\"replay requires no connection\"}";
+	}
+	if (replay_.get() != nullptr) {
+		return "{\"error\":\"replay is running\"}";
+	}
+	if (records.empty()) {
+		return "{\"error\":\"no record\"}";
+	}
+
+	replay_.reset(new treplay(realtime));
+	treplay& replay = *replay_.get();
+	replay.records.swap(records);
+	// trace may have multi-connection, replay the first one.
+	replay.connection_id = replay.records.front().connection_id;
+
+	// same as OnConnect, but read/write layer are replay's.
+	kos_check_resize(freerdp_server_);
+	replay.peer = freerdp_peer_new(fake_peer_socket_);
+	UpdateSubscriber_ = rose_did_shadow_peer_connect(freerdp_server_, replay.peer, &gfxstatus_);
+	rose_register_extra(replay.peer->context, did_replay_read_layer, did_replay_write_layer, this, &replay.source);
+	freerdp_server_->rose_delegate = this;
+
+	{
+		threading::lock lock(replay_mutex_);
+		replay_result_ = "{\"replay\":\"running\"}";
+	}
+	replay.start_us = perf_counters::now_us();
+	base::ThreadTaskRunnerHandle::Get()->PostTask(FROM_HERE, base::Bind(&RdpServerRose::replay_pdu_step, weak_ptr_factory_.GetWeakPtr()));
+	return "{\"replay\":\"started\"}";
+}
+
+void RdpServerRose::replay_pdu_step()
+{
+	VALIDATE_IN_RDPD_THREAD();
+	if (replay_.get() == nullptr) {
+		// finished by OnConnect.
+		return;
+	}
+
+	// fast replay yields to other tasks every batch records, realtime one every due record.
+	const int batch = 64;
+	treplay& replay = *replay_.get();
+	rdpRdp* rdp = replay.peer->context->rdp;
+	for (int handled = 0; replay.next < replay.records.size() && replay.iret >= 0 && handled < batch; replay.next ++) {
+		const pdu_trace::trecord& record = replay.records[replay.next];
+		if (record.connection_id != replay.connection_id) {
+			continue;
+		}
+		if (replay.realtime) {
+			const int64_t wait_us = replay.start_us + record.timestamp_us - perf_counters::now_us();
+			if (wait_us > 0) {
+				base::ThreadTaskRunnerHandle::Get()->PostDelayedTask(FROM_HERE, base::Bind(&RdpServerRose::replay_pdu_step, weak_ptr_factory_.GetWeakPtr()),
+					base::TimeDelta::FromMicroseconds(wait_us));
+				return;
+			}
+		}
+		replay.source.data = record.bytes.data();
+		replay.source.len = record.bytes.size();
+		replay.source.consumed = 0;
+		replay.iret = 1;
+		while (replay.iret == 1 && replay.source.consumed < replay.source.len) {
+			replay.iret = rose_did_read(rdp);
+			replay.pdus ++;
+		}
+		replay.replayed ++;
+		replay.bytes += replay.source.consumed;
+		handled ++;
+	}
+
+	if (replay.next < replay.records.size() && replay.iret >= 0) {
+		base::ThreadTaskRunnerHandle::Get()->PostTask(FROM_HERE, base::Bind(&RdpServerRose::replay_pdu_step, weak_ptr_factory_.GetWeakPtr()));
+		return;
+	}
+	finish_replay_pdu_trace(replay.iret >= 0? nullptr: "rose_did_read fail");
+}
+
+void RdpServerRose::finish_replay_pdu_trace(const char* error)
+{
+	VALIDATE_IN_RDPD_THREAD();
+	VALIDATE(replay_.get() != nullptr, null_str);
+
+	const treplay& replay = *replay_.get();
+	const int64_t elapsed_us = perf_counters::now_us() - replay.start_us;
+	rose_did_shadow_peer_disconnect(freerdp_server_, replay.peer, &gfxstatus_, UpdateSubscriber_);
+	rose_shadow_subsystem_stop(freerdp_server_->subsystem);
+	// start_replay_pdu_trace created the peer, nothing else references it.
+	freerdp_peer_context_free(replay.peer);
+	freerdp_peer_free(replay.peer);
+	freerdp_server_->rose_delegate = nullptr;
+	client_os_ = nposm;
+
+	std::stringstream ss;
+	ss << "{\"replay\":\"finished\",\"records\":" << replay.replayed << ",\"pdus\":" << replay.pdus << ",\"bytes\":" << replay.bytes;
+	ss << ",\"elapsed_us\":" << elapsed_us << ",\"ok\":" << (error == nullptr? "true": "false");
+	if (error != nullptr) {
+		ss << ",\"error\":\"" << error << "\"";
+	}
+	ss << "}";
+	replay_.reset();
+	SDL_Log("RdpServerRose::finish_replay_pdu_trace, %s", ss.str().c_str());
+
+	threading::lock lock(replay_mutex_);
+	replay_result_ = ss.str();
+}
+
+std::string RdpServerRose::replay_status()
+{
+	threading::lock lock(replay_mutex_);
+	return replay_result_.empty()? "{\"replay\":\"none\"}": replay_result_;
+}
+
 void RdpServerRose::send_startup_msg(uint32_t ticks, int rdpstatus)
 {
 	if (game_config::explorer_singleton == nullptr) {
@@ -584,6 +889,10 @@ void trdpd_manager::start(uint32_t ipaddr)
 
 	thread_->task_runner()->PostTask(FROM_HERE, base::BindOnce(&trdpd_manager::start_internal, base::Unretained(this), ipaddr));
 	e_.Wait();
+
+	perf_server_.register_command("trace", frame_trace::handle_trace_command);
+	perf_server_.register_command("pdu", std::bind(&trdpd_manager::handle_pdu_command, this, _1));
+	perf_server_.start();
 }
 
 void trdpd_manager::stop()
@@ -594,6 +903,9 @@ void trdpd_manager::stop()
 	}
 
 	CHECK(delegate_.get() != nullptr);
+	perf_server_.stop();
+	frame_trace::stop_chrome_trace();
+	pdu_trace::stop_record();
 	// stop_internal will reset delegate_.
 
 	thread_->task_runner()->PostTask(FROM_HERE, base::BindOnce(&trdpd_manager::stop_internal, base::Unretained(this)));
@@ -644,6 +956,61 @@ void trdpd_manager::push_explorer_update(uint32_t code, uint32_t data1, uint32_t
 	}
 }
 
+void trdpd_manager::replay_pdu_trace_internal(std::vector<pdu_trace::trecord>* records, bool realtime, std::string* result, base::WaitableEvent* e)
+{
+	*result = delegate_->start_replay_pdu_trace(*records, realtime);
+	e->Signal();
+}
+
+std::string trdpd_manager::replay_pdu_trace(const std::string& path, bool realtime)
+{
+	VALIDATE(game_config::rdpd_tid != SDL_ThreadID(), null_str);
+	if (thread_.get() == nullptr) {
+		return "{\"error\":\"rdpd isn't running\"}";
+	}
+	std::vector<pdu_trace::trecord> records;
+	if (!pdu_trace::load(path, records)) {
+		return "{\"error\":\"invalid trace file\"}";
+	}
+
+	// wait only for start, records are fed by rdpd thread's tasks later.
+	std::string result;
+	base::WaitableEvent e(base::WaitableEvent::ResetPolicy::AUTOMATIC, base::WaitableEvent::InitialState::NOT_SIGNALED);
+	thread_->task_runner()->PostTask(FROM_HERE, base::BindOnce(&trdpd_manager::replay_pdu_trace_internal, base::Unretained(this), &records, realtime, &result, &e));
+	e.Wait();
+	return result;
+}
+
+std::string trdpd_manager::handle_pdu_command(const std::string& args)
+{
+	// pdu record start <name> | pdu record stop | pdu replay <name> [fast] | pdu status
+	// files are in perf_counters::output_path.
+	std::vector<std::string> vstr = utils::split(args, ' ');
+	if (vstr.size() == 3 && vstr[0] == "record" && vstr[1] == "start") {
+		const std::string path = perf_counters::output_path(vstr[2]);
+		if (path.empty()) {
+			return "{\"error\":\"invalid file name\"}";
+		}
+		return pdu_trace::start_record(path)? "{\"record\":\"started\"}": "{\"error\":\"recording, or can not open file\"}";
+
+	} else if (vstr.size() == 2 && vstr[0] == "record" && vstr[1] == "stop") {
+		pdu_trace::stop_record();
+		return "{\"record\":\"stopped\"}";
+
+	} else if ((vstr.size() == 2 || vstr.size() == 3) && vstr[0] == "replay") {
+		const std::string path = perf_counters::output_path(vstr[1]);
+		if (path.empty()) {
+			return "{\"error\":\"invalid file name\"}";
+		}
+		const bool realtime = vstr.size() == 2 || vstr[2] != "fast";
+		return replay_pdu_trace(path, realtime);
+
+	} else if (vstr.size() == 1 && vstr[0] == "status") {
+		return delegate_.get() != nullptr? delegate_->replay_status(): "{\"error\":\"rdpd isn't running\"}";
+	}
+	return "{\"error\":\"usage: pdu record start <name> | pdu record stop | pdu replay <name> [fast] | pdu status\"}";
+}
+
 bool trdpd_manager::support_drag_copy()
 {
 	RdpConnection* connection = connectionfinished_connection();
@@ -19,11 +19,16 @@
 #include <wml_exception.hpp>
 
 #include "freerdp/freerdp.h"
+#include "perf_counters.hpp"
+#include "frame_trace.hpp"
+#include "pdu_trace.hpp"
 
 enum {rdpdstatus_connectionfinished, rdpdstatus_connectionclosed};
 
 namespace net {
 
+struct treplay;
+
 // Bas on HttpServerTest of chromium.
 class RdpServerRose: public RdpServer::Delegate
 {
@@ -51,14 +56,28 @@ public:
 	bool can_hdrop_paste() const;
 	void push_explorer_update(uint32_t code, uint32_t data1, uint32_t data2, uint32_t data3);
 
+	frame_trace::ttracer& frame_tracer() { return frame_tracer_; }
+
+	// feed records of one connection to rose_did_read against a fake peer, server must have no connection.
+	// realtime: keep recorded timing, or as fast as possible.
+	// replay runs as delayed tasks on rdpd thread, this only starts it, and returns "started" or error as json.
+	// a client connecting during replay stops it.
+	std::string start_replay_pdu_trace(std::vector<pdu_trace::trecord>& records, bool realtime);
+	// result of the last replay as json. can be called in any thread.
+	std::string replay_status();
+
 private:
 	void did_connect_bh();
 	void rdpd_slice(int timeout);
 	void did_slice_quited(int timeout);
 	void handle_pause_record_screen(RdpConnection& connection, bool desire_pause);
+	void record_rtt(uint16_t response_sequence_number);
 
 	void send_startup_msg(uint32_t ticks, int rdpstatus);
 
+	void replay_pdu_step();
+	void finish_replay_pdu_trace(const char* error);
+
 protected:
 	base::Thread& thread_;
 	base::WaitableEvent& delete_pend_tasks_e_;
@@ -77,12 +96,22 @@ private:
 	void* UpdateSubscriber_;
 
 	bool slice_running_;
-	uint32_t startup_verbose_ticks_;
-	uint32_t last_verbose_ticks_;
 	int client_os_;
 
+	// ticks when send RTTMeasureRequest, indexed by sequence number. at most 3 requests are outstanding.
+	uint32_t rtt_request_ticks_[4];
+	uint16_t rtt_response_sequence_number_;
+
+	frame_trace::ttracer frame_tracer_;
+
+	std::unique_ptr<treplay> replay_;
+	threading::mutex replay_mutex_;
+	std::string replay_result_;
+
 	threading::mutex rdpd_thread_explorer_update_mutex_;
 	std::vector<LEAGOR_EXPLORER_UPDATE> rdpd_thread_explorer_update_;
+	// only used by rdpd thread.
+	std::vector<LEAGOR_EXPLORER_UPDATE> sending_explorer_update_;
 };
 
 class trdpd_manager: public tserver_
@@ -113,10 +142,16 @@ public:
 	void push_explorer_update(uint32_t code, uint32_t data1, uint32_t data2, uint32_t data3);
 	bool support_drag_copy();
 
+	// can be called in any thread except rdpd thread. it returns after replay started, not finished.
+	std::string replay_pdu_trace(const std::string& path, bool realtime);
+
 private:
 	void start(uint32_t ipaddr) override;
 	void stop() override;
 
+	std::string handle_pdu_command(const std::string& args);
+	void replay_pdu_trace_internal(std::vector<pdu_trace::trecord>* records, bool realtime, std::string* result, base::WaitableEvent* e);
+
 	void did_set_event();
 	void start_internal(uint32_t ipaddr);
 	void stop_internal();
@@ -125,6 +160,7 @@ private:
 	std::unique_ptr<base::Thread> thread_;
 	std::unique_ptr<RdpServerRose> delegate_;
 	base::WaitableEvent e_;
+	perf_counters::tserver perf_server_;
 };
 
 }  // namespace net